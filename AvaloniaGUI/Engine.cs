@@ -8,12 +8,25 @@ using System.Threading.Tasks;
 
 namespace AvaloniaGUI
 {
+	// Must match ePacingMode in interop.h
+	public enum ePacingMode
+	{
+		PACING_UNCAPPED = 0,
+		PACING_FIXED = 1,
+		PACING_DISPLAY = 2,
+	}
+
 	public sealed class Engine
 	{
 		[DllImport("VulkanRenderer.dll")]
 		static extern IntPtr initEngine(IntPtr callback);
 		[DllImport("VulkanRenderer.dll")]
 		static extern void destroyEngine(IntPtr vulkanPtr);
+		[DllImport("VulkanRenderer.dll")]
+		static extern int setFramePacing(IntPtr vulkanPtr, int mode, double framesPerSecond);
+		[DllImport("VulkanRenderer.dll")]
+		static extern int setOnDemandRendering(IntPtr vulkanPtr, [MarshalAs(UnmanagedType.U1)] bool enabled,
+			double keepAliveFramesPerSecond);
 
 		private static void debugCallback([MarshalAs(UnmanagedType.LPStr)] string msg)
 		{
@@ -42,5 +55,18 @@ namespace AvaloniaGUI
 		{
 			return lazy.Value;
 		}
+
+		// framesPerSecond is only used by PACING_FIXED.
+		public void SetFramePacing(ePacingMode mode, double framesPerSecond = 0)
+		{
+			setFramePacing(vulkanPtr, (int)mode, framesPerSecond);
+		}
+
+		// While enabled the render thread only draws when something changed, see RenderSurface.RequestRedraw. A
+		// keepAliveFramesPerSecond above 0 still draws at least that often.
+		public void SetOnDemandRendering(bool enabled, double keepAliveFramesPerSecond = 0)
+		{
+			setOnDemandRendering(vulkanPtr, enabled, keepAliveFramesPerSecond);
+		}
 	}
 }
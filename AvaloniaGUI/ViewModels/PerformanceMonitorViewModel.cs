@@ -1,46 +1,73 @@
-﻿using ReactiveUI;
+﻿using Avalonia.Threading;
+using ReactiveUI;
 using System;
-using System.Diagnostics;
 using System.Runtime.InteropServices;
 
 
 namespace AvaloniaGUI.ViewModels
 {
+	// Must match sFrameSample in interop.h
 	[StructLayout(LayoutKind.Sequential)]
-	public unsafe struct sPerf
+	public struct sFrameSample
 	{
-		public fixed double frameDelta[100];
-		public int currentFrame;
+		public double cpuFrame;
+		public double submitToPresent;
+		public double gpuFrame;
+		public double cpuRecord;
+		public double acquireWait;
+		public double paceJitter;
 	}
 
-	
-
-	public unsafe class PerformanceMonitorViewModel : ViewModelBase
+	public class PerformanceMonitorViewModel : ViewModelBase
 	{
 		[DllImport("VulkanRenderer.dll", CallingConvention = CallingConvention.StdCall)]
-		static extern bool setPerformanceMonitorCallback(IntPtr vulkanPtr, IntPtr callback);
-
-		private Stopwatch timer = new();
+		static extern int readPerfSamples(IntPtr vulkanPtr, [Out] sFrameSample[] buffer, int max);
 
 		private const double FPS_limit = 5;
-		private long previous_draw = Stopwatch.GetTimestamp();
+		private const int WINDOW_SIZE = 100;
+
+		// The renderer pushes samples into a native ring buffer. We poll it from the UI thread at our own pace, so a
+		// slow UI never holds up the render thread.
+		private readonly DispatcherTimer timer;
+		private readonly sFrameSample[] readBuffer = new sFrameSample[256];
+		private readonly sFrameSample[] window = new sFrameSample[WINDOW_SIZE];
+		private int windowIndex = 0;
+		private int windowCount = 0;
 
-		public void nativeCallback(sPerf data)
+		private void poll(object? sender, EventArgs e)
 		{
-			
-			if (timer.ElapsedMilliseconds > (1000 / FPS_limit))
+			int count;
+			do
 			{
-				double fr = 0;
-				for (int i = 0; i < 100; i++)
+				count = readPerfSamples(vulkanPtr, readBuffer, readBuffer.Length);
+				for (int i = 0; i < count; i++)
 				{
-					fr += data.frameDelta[i];
+					window[windowIndex] = readBuffer[i];
+					windowIndex = (windowIndex + 1) % WINDOW_SIZE;
+					windowCount = Math.Min(windowCount + 1, WINDOW_SIZE);
 				}
-				Framerate = fr / 100;
-				timer.Restart();
+			} while (count == readBuffer.Length);
+
+			if (windowCount == 0)
+			{
+				return;
 			}
+
+			double fr = 0, gpu = 0, cpu = 0, wait = 0, jitter = 0;
+			for (int i = 0; i < windowCount; i++)
+			{
+				fr += window[i].cpuFrame;
+				gpu += window[i].gpuFrame;
+				cpu += window[i].cpuRecord;
+				wait += window[i].acquireWait;
+				jitter += window[i].paceJitter;
+			}
+			Framerate = fr / windowCount;
+			GpuTime = gpu / windowCount * 1000;
+			CpuTime = cpu / windowCount * 1000;
+			WaitTime = wait / windowCount * 1000;
+			JitterTime = jitter / windowCount * 1000;
 		}
-		public delegate void NativeCallbackDelegate(sPerf value);
-		private NativeCallbackDelegate cb { get; set; }
 
 		public IntPtr vulkanPtr { get; private set; }
 
@@ -51,24 +78,40 @@ namespace AvaloniaGUI.ViewModels
 			set => this.RaiseAndSetIfChanged(ref framerate, 1.0 / value);
 		}
 
-		public void attachVulkan(IntPtr vulkan)
+		// Average times in milliseconds
+		private double gpuTime = 0;
+		public double GpuTime
 		{
-			vulkanPtr = vulkan;
-			IntPtr fp = Marshal.GetFunctionPointerForDelegate(cb);
-			if (!setPerformanceMonitorCallback(vulkan, fp))
-			{
-				Debug.WriteLine("Failed to set Performance Monitor callback!");
-				throw new ExternalException();
-			}
+			get => gpuTime;
+			set => this.RaiseAndSetIfChanged(ref gpuTime, value);
+		}
+
+		private double cpuTime = 0;
+		public double CpuTime
+		{
+			get => cpuTime;
+			set => this.RaiseAndSetIfChanged(ref cpuTime, value);
+		}
+
+		private double waitTime = 0;
+		public double WaitTime
+		{
+			get => waitTime;
+			set => this.RaiseAndSetIfChanged(ref waitTime, value);
+		}
+
+		private double jitterTime = 0;
+		public double JitterTime
+		{
+			get => jitterTime;
+			set => this.RaiseAndSetIfChanged(ref jitterTime, value);
 		}
 
 		public PerformanceMonitorViewModel()
 		{
-			cb = new NativeCallbackDelegate(nativeCallback);
 			vulkanPtr = Engine.Get().vulkanPtr;
+			timer = new DispatcherTimer(TimeSpan.FromMilliseconds(1000 / FPS_limit), DispatcherPriority.Background, poll);
 			timer.Start();
-			attachVulkan(vulkanPtr);
-			
 		}
 	}
 }
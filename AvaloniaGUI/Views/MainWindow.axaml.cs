@@ -37,10 +37,18 @@ public partial class MainWindow : Window
 		}
 		toggle ^= true;
 	}
+
+	// The renderer keeps the setting across detach and attach, so it doesn't matter whether a surface is up.
+	void OnDemandBox_OnClick(object? sender, RoutedEventArgs args)
+	{
+		Engine.Get().SetOnDemandRendering(OnDemandBox.IsChecked == true);
+		Surface?.RequestRedraw();
+	}
 	public MainWindow()
 	{
 		InitializeComponent();
 
 		TheButton.Click += TheButton_OnClick;
+		OnDemandBox.Click += OnDemandBox_OnClick;
 	}
 }
@@ -1,4 +1,6 @@
-﻿using Avalonia.Controls;
+﻿using Avalonia;
+using Avalonia.Controls;
+using Avalonia.Input;
 using Avalonia.Interactivity;
 using Avalonia.Markup.Xaml;
 using Avalonia.Media.TextFormatting;
@@ -21,6 +23,10 @@ namespace AvaloniaGUI.Views
 		static extern void attachRenderer(IntPtr vulkanPtr, IntPtr handle);
 		[DllImport("VulkanRenderer.dll")]
 		static extern void detachRenderer(IntPtr vulkanPtr, IntPtr handle);
+		[DllImport("VulkanRenderer.dll")]
+		static extern int resizeRenderer(IntPtr vulkanPtr, IntPtr handle, int width, int height, double dpiScale);
+		[DllImport("VulkanRenderer.dll")]
+		static extern int requestRedraw(IntPtr vulkanPtr);
 
 			
 		public IntPtr vulkanPtr { get; private set; }
@@ -31,14 +37,82 @@ namespace AvaloniaGUI.Views
 		{
 			vulkanPtr = Engine.Get().vulkanPtr;
 			attachRenderer(vulkanPtr, Handle);
+			PostSize(Bounds.Size);
 			base.OnLoaded(e);
 		}
 
 		protected override void OnSizeChanged(SizeChangedEventArgs e)
 		{
+			PostSize(e.NewSize);
 			base.OnSizeChanged(e);
 		}
 
+		// Cheap enough to call on every layout pass, the render thread only picks up the latest size once per frame.
+		private void PostSize(Avalonia.Size size)
+		{
+			if (vulkanPtr == IntPtr.Zero)
+			{
+				return;
+			}
+			double scaling = VisualRoot?.RenderScaling ?? 1.0;
+			resizeRenderer(vulkanPtr, Handle, (int)Math.Ceiling(size.Width), (int)Math.Ceiling(size.Height), scaling);
+		}
+
+		// With on-demand rendering the renderer only draws when something changed. Scene edits, cameras and resizes wake
+		// it up by themselves; everything else that can change what the surface shows goes through here. Cheap, a
+		// burst of calls still draws a single frame.
+		public void RequestRedraw()
+		{
+			if (vulkanPtr == IntPtr.Zero)
+			{
+				return;
+			}
+			requestRedraw(vulkanPtr);
+		}
+
+		protected override void OnPointerMoved(PointerEventArgs e)
+		{
+			RequestRedraw();
+			base.OnPointerMoved(e);
+		}
+
+		protected override void OnPointerPressed(PointerPressedEventArgs e)
+		{
+			RequestRedraw();
+			base.OnPointerPressed(e);
+		}
+
+		protected override void OnPointerReleased(PointerReleasedEventArgs e)
+		{
+			RequestRedraw();
+			base.OnPointerReleased(e);
+		}
+
+		protected override void OnPointerWheelChanged(PointerWheelEventArgs e)
+		{
+			RequestRedraw();
+			base.OnPointerWheelChanged(e);
+		}
+
+		protected override void OnKeyDown(KeyEventArgs e)
+		{
+			RequestRedraw();
+			base.OnKeyDown(e);
+		}
+
+		protected override void OnKeyUp(KeyEventArgs e)
+		{
+			RequestRedraw();
+			base.OnKeyUp(e);
+		}
+
+		// Visibility, theme, opacity and the like.
+		protected override void OnPropertyChanged(AvaloniaPropertyChangedEventArgs change)
+		{
+			RequestRedraw();
+			base.OnPropertyChanged(change);
+		}
+
 		protected override void OnUnloaded(RoutedEventArgs e)
 		{
 			detachRenderer(vulkanPtr, Handle);
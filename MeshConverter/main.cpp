@@ -0,0 +1,139 @@
+// Converts Wavefront OBJ meshes into the renderer's .vkmesh format (mesh_file.hpp), laid out exactly as the scene
+// pipeline reads them, so the renderer can map them and copy them to the GPU without parsing anything.
+//
+//   MeshConverter input.obj output.vkmesh
+//
+// Only positions, vertex colors (the common "v x y z r g b" extension) and faces are read. Faces with more than three
+// corners are split into fans. The scene's vertices are 2D, so z is dropped.
+
+#include "mesh_file.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Must match Vertex in renderer.hpp.
+struct MeshVertex {
+  float pos[2];
+  float color[3];
+};
+static_assert(sizeof(MeshVertex) == 20, "MeshVertex must match the renderer's Vertex");
+
+struct Mesh {
+  std::vector<MeshVertex> vertices;
+  std::vector<uint32_t> indices;
+};
+
+// The position index of a face corner ("i", "i/t", "i/t/n" or "i//n"), 1-based or negative counting back from the
+// last vertex.
+static uint32_t parseCorner(const std::string &corner, size_t vertexCount, size_t line)
+{
+  long index = 0;
+  try {
+    index = std::stol(corner.substr(0, corner.find('/')));
+  }
+  catch (std::exception &) {
+    throw std::runtime_error("bad face corner '" + corner + "' on line " + std::to_string(line) + "!");
+  }
+
+  long resolved = index < 0 ? static_cast<long>(vertexCount) + index : index - 1;
+  if (index == 0 || resolved < 0 || resolved >= static_cast<long>(vertexCount)) {
+    throw std::runtime_error("face corner '" + corner + "' on line " + std::to_string(line) + " is out of range!");
+  }
+  return static_cast<uint32_t>(resolved);
+}
+
+static Mesh readObj(const std::string &path)
+{
+  std::ifstream in(path);
+  if (!in) {
+    throw std::runtime_error("failed to open file " + path + "!");
+  }
+
+  Mesh mesh;
+  std::string text;
+  size_t line = 0;
+  while (std::getline(in, text)) {
+    line++;
+    std::istringstream tokens(text);
+    std::string keyword;
+    tokens >> keyword;
+
+    if (keyword == "v") {
+      float z;
+      MeshVertex vertex = { { 0.0f, 0.0f }, { 1.0f, 1.0f, 1.0f } };
+      if (!(tokens >> vertex.pos[0] >> vertex.pos[1] >> z)) {
+        throw std::runtime_error("bad vertex on line " + std::to_string(line) + "!");
+      }
+      float r, g, b;
+      if (tokens >> r >> g >> b) {
+        vertex.color[0] = r;
+        vertex.color[1] = g;
+        vertex.color[2] = b;
+      }
+      mesh.vertices.push_back(vertex);
+    }
+    else if (keyword == "f") {
+      std::vector<uint32_t> corners;
+      std::string corner;
+      while (tokens >> corner) {
+        corners.push_back(parseCorner(corner, mesh.vertices.size(), line));
+      }
+      if (corners.size() < 3) {
+        throw std::runtime_error("face with fewer than three corners on line " + std::to_string(line) + "!");
+      }
+      for (size_t i = 2; i < corners.size(); i++) {
+        mesh.indices.insert(mesh.indices.end(), { corners[0], corners[i - 1], corners[i] });
+      }
+    }
+  }
+  return mesh;
+}
+
+int main(int argc, char **argv)
+{
+  if (argc != 3) {
+    std::cerr << "Usage: MeshConverter input.obj output.vkmesh" << std::endl;
+    return 1;
+  }
+
+  try {
+    Mesh mesh = readObj(argv[1]);
+    if (mesh.vertices.empty() || mesh.indices.empty()) {
+      throw std::runtime_error(std::string(argv[1]) + " has no faces!");
+    }
+
+    float radius = 0;
+    for (const MeshVertex &vertex : mesh.vertices) {
+      radius = std::max(radius, std::sqrt(vertex.pos[0] * vertex.pos[0] + vertex.pos[1] * vertex.pos[1]));
+    }
+
+    uint32_t vertexCount = static_cast<uint32_t>(mesh.vertices.size());
+    uint32_t indexCount = static_cast<uint32_t>(mesh.indices.size());
+
+    // 16-bit indices halve the index stream whenever every vertex fits.
+    if (vertexCount <= UINT16_MAX + 1) {
+      std::vector<uint16_t> shortIndices(mesh.indices.begin(), mesh.indices.end());
+      writeMeshFile(argv[2], mesh.vertices.data(), sizeof(MeshVertex), vertexCount, shortIndices.data(), 2, indexCount,
+                    radius);
+    }
+    else {
+      writeMeshFile(argv[2], mesh.vertices.data(), sizeof(MeshVertex), vertexCount, mesh.indices.data(), 4, indexCount,
+                    radius);
+    }
+
+    std::cout << argv[2] << ": " << vertexCount << " vertices, " << indexCount / 3 << " triangles" << std::endl;
+  }
+  catch (std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
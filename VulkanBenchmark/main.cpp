@@ -0,0 +1,643 @@
+#include "renderer.hpp"
+
+#include "report.hpp"
+
+#include <cmath>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <random>
+
+// Scenes the benchmark knows how to set up. Every scene gets a freshly attached headless renderer.
+struct BenchmarkScene {
+  std::string name;
+  std::function<void(Renderer &)> setup;
+};
+
+// count small quads laid out on a square grid that fills the view. Every quad is its own draw. With a halfSize
+// above 1 most of the grid lies outside the view and is culled.
+static std::vector<DrawItem> makeGrid(uint32_t count, float halfSize = 1.0f)
+{
+  uint32_t side = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<double>(count))));
+  float spacing = 2.0f * halfSize / side;
+
+  std::vector<DrawItem> items;
+  items.reserve(count);
+  for (uint32_t i = 0; i < count; i++) {
+    float x = -halfSize + spacing * (i % side + 0.5f);
+    float y = -halfSize + spacing * (i / side + 0.5f);
+    glm::mat4 model = glm::translate(glm::mat4(1.0f), glm::vec3(x, y, 0.0f));
+    items.push_back({ glm::scale(model, glm::vec3(spacing * 0.8f)) });
+  }
+  return items;
+}
+
+// count quads like makeGrid, but as instances drawn with a single instanced draw. Each is turned a little so the
+// rotation path of the vertex shader is exercised too. The grid spans -halfSize..halfSize; beyond 1 most of it lies
+// outside the default camera's view and is culled.
+static std::vector<InstanceData> makeInstanceGrid(uint32_t count, float halfSize = 1.0f)
+{
+  uint32_t side = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<double>(count))));
+  float spacing = 2.0f * halfSize / side;
+
+  std::vector<InstanceData> instances;
+  instances.reserve(count);
+  for (uint32_t i = 0; i < count; i++) {
+    float x = -halfSize + spacing * (i % side + 0.5f);
+    float y = -halfSize + spacing * (i / side + 0.5f);
+    instances.push_back({ glm::vec3(x, y, 0.0f), glm::vec3(0.0f, 0.0f, 0.001f * (i % 1000)), spacing * 0.8f });
+  }
+  return instances;
+}
+
+const std::vector<BenchmarkScene> scenes = {
+  {"quad", [](Renderer &) {}},
+  {"grid10k", [](Renderer &r) { r.setDrawItems(makeGrid(10000)); }},
+  {"grid50k", [](Renderer &r) { r.setDrawItems(makeGrid(50000)); }},
+  {"grid100k", [](Renderer &r) { r.setDrawItems(makeGrid(100000)); }},
+  {"grid200k_wide", [](Renderer &r) { r.setDrawItems(makeGrid(200000, 10.0f)); }},
+  {"instances1m", [](Renderer &r) { r.setDrawItems({}); r.setInstances(makeInstanceGrid(1000000)); }},
+  {"instances1m_wide", [](Renderer &r) { r.setDrawItems({}); r.setInstances(makeInstanceGrid(1000000, 10.0f)); }},
+};
+
+struct Options {
+  uint32_t frames = 1000;
+  uint32_t warmup = 100;
+  std::vector<std::string> scenes; // quad, unless only the culling microbenchmark was asked for
+  std::vector<std::pair<uint32_t, uint32_t>> resolutions = {
+    {1280, 720}
+  };
+  std::vector<uint32_t> framesInFlight = { MAX_FRAMES_IN_FLIGHT };
+  std::vector<uint32_t> recordThreads = { 1 };
+  uint32_t attachSamples = 3;
+  std::vector<uint32_t> cullObjects;
+  std::vector<uint32_t> transformNodes;
+  std::vector<uint32_t> jobThreads;
+  std::vector<uint32_t> meshVertices;
+  std::string pipelineCache = "benchmark_pipeline_cache.bin";
+
+  std::string output;
+  std::string baseline;
+  double threshold = 0.10;
+  double minDeltaMs = 0.05;
+};
+
+static std::vector<std::string> split(const std::string &value, char separator)
+{
+  std::vector<std::string> parts;
+  std::stringstream ss(value);
+  std::string part;
+  while (std::getline(ss, part, separator)) {
+    if (!part.empty()) {
+      parts.push_back(part);
+    }
+  }
+  return parts;
+}
+
+static void printUsage()
+{
+  std::cout << "Usage: VulkanBenchmark [options]\n"
+            << "  --frames N              measured frames per run (default 1000)\n"
+            << "  --warmup N              frames rendered before measuring (default 100)\n"
+            << "  --scene a,b             scenes to run (default quad)\n"
+            << "  --resolution WxH,...    offscreen resolutions (default 1280x720)\n"
+            << "  --frames-in-flight N,.. frames in flight (default 2)\n"
+            << "  --record-threads N,...  command recording threads, 1 records inline (default 1)\n"
+            << "  --attach-samples N      cold and warm pipeline cache attaches timed per run, 0 to skip (default 3)\n"
+            << "  --cull-objects N,...    also time CPU frustum culling of N spheres on every SIMD path, no renderer\n"
+            << "  --transform-nodes N,... also time updates of an N-node transform hierarchy, no renderer\n"
+            << "  --job-threads N,...     also time the job system with N threads (including the caller), no renderer\n"
+            << "  --mesh-load N,...       also time loading and uploading a .vkmesh of about N vertices\n"
+            << "  --pipeline-cache FILE   pipeline cache used by the benchmark (default benchmark_pipeline_cache.bin)\n"
+            << "  --output FILE           write the JSON report to FILE instead of stdout\n"
+            << "  --baseline FILE         compare against a stored report, exit 1 on regression\n"
+            << "  --threshold X           allowed relative slowdown against the baseline (default 0.10)\n"
+            << "  --min-delta-ms X        ignore regressions smaller than X ms (default 0.05)\n";
+}
+
+static Options parseOptions(int argc, char **argv)
+{
+  Options options;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    auto next = [&]() -> std::string {
+      if (i + 1 >= argc) {
+        throw std::runtime_error("missing value for " + arg);
+      }
+      return argv[++i];
+    };
+
+    if (arg == "--frames") {
+      options.frames = std::stoul(next());
+    }
+    else if (arg == "--warmup") {
+      options.warmup = std::stoul(next());
+    }
+    else if (arg == "--scene") {
+      options.scenes = split(next(), ',');
+    }
+    else if (arg == "--resolution") {
+      options.resolutions.clear();
+      for (const std::string &res : split(next(), ',')) {
+        auto wh = split(res, 'x');
+        if (wh.size() != 2) {
+          throw std::runtime_error("resolution must be WxH: " + res);
+        }
+        options.resolutions.push_back({ std::stoul(wh[0]), std::stoul(wh[1]) });
+      }
+    }
+    else if (arg == "--frames-in-flight") {
+      options.framesInFlight.clear();
+      for (const std::string &n : split(next(), ',')) {
+        options.framesInFlight.push_back(std::stoul(n));
+      }
+    }
+    else if (arg == "--record-threads") {
+      options.recordThreads.clear();
+      for (const std::string &n : split(next(), ',')) {
+        options.recordThreads.push_back(std::stoul(n));
+      }
+    }
+    else if (arg == "--attach-samples") {
+      options.attachSamples = std::stoul(next());
+    }
+    else if (arg == "--cull-objects") {
+      for (const std::string &n : split(next(), ',')) {
+        options.cullObjects.push_back(std::stoul(n));
+      }
+    }
+    else if (arg == "--transform-nodes") {
+      for (const std::string &n : split(next(), ',')) {
+        options.transformNodes.push_back(std::stoul(n));
+      }
+    }
+    else if (arg == "--job-threads") {
+      for (const std::string &n : split(next(), ',')) {
+        options.jobThreads.push_back(std::stoul(n));
+      }
+    }
+    else if (arg == "--mesh-load") {
+      for (const std::string &n : split(next(), ',')) {
+        options.meshVertices.push_back(std::stoul(n));
+      }
+    }
+    else if (arg == "--pipeline-cache") {
+      options.pipelineCache = next();
+    }
+    else if (arg == "--output") {
+      options.output = next();
+    }
+    else if (arg == "--baseline") {
+      options.baseline = next();
+    }
+    else if (arg == "--threshold") {
+      options.threshold = std::stod(next());
+    }
+    else if (arg == "--min-delta-ms") {
+      options.minDeltaMs = std::stod(next());
+    }
+    else if (arg == "--help" || arg == "-h") {
+      printUsage();
+      std::exit(0);
+    }
+    else {
+      throw std::runtime_error("unknown option " + arg);
+    }
+  }
+  if (options.scenes.empty() && options.cullObjects.empty() && options.transformNodes.empty() &&
+      options.jobThreads.empty() && options.meshVertices.empty()) {
+    options.scenes = { "quad" };
+  }
+  return options;
+}
+
+// Renderer::attach logs and swallows its errors. Without a device or swapchain, driving frames would crash on the
+// half-built renderer, so fail the run here instead.
+static void checkAttached(const Renderer &renderer)
+{
+  if (!renderer.isAttached()) {
+    throw std::runtime_error("failed to attach the headless renderer, see the debug output");
+  }
+}
+
+// Seconds spent in attach by a fresh renderer. Constructing the renderer loads the pipeline cache, destroying it
+// saves the cache back.
+static double measureAttach(const Options &options, uint32_t width, uint32_t height, uint32_t framesInFlight)
+{
+  auto renderer = std::make_unique<Renderer>(true, options.pipelineCache);
+
+  SurfaceInfo surfaceInfo {};
+  surfaceInfo.width = static_cast<int>(width);
+  surfaceInfo.height = static_cast<int>(height);
+  surfaceInfo.framesInFlight = framesInFlight;
+
+  Timing<std::chrono::duration<double, std::ratio<1>>> t;
+  renderer->attach(surfaceInfo, false);
+  double seconds = t.tock().count();
+  checkAttached(*renderer);
+
+  renderer->detach();
+  return seconds;
+}
+
+static RunResult runBenchmark(const Options &options, const BenchmarkScene &scene, uint32_t width, uint32_t height,
+                              uint32_t framesInFlight, uint32_t recordThreads)
+{
+  // Cold attaches start without a cache file, warm ones use the file the previous attach saved. Drivers with their
+  // own shader cache make cold attaches look better than on a truly fresh machine.
+  std::vector<double> coldAttach, warmAttach;
+  for (uint32_t i = 0; i < options.attachSamples; i++) {
+    std::filesystem::remove(options.pipelineCache);
+    coldAttach.push_back(measureAttach(options, width, height, framesInFlight));
+    warmAttach.push_back(measureAttach(options, width, height, framesInFlight));
+  }
+
+  auto renderer = std::make_unique<Renderer>(true, options.pipelineCache);
+
+  SurfaceInfo surfaceInfo {};
+  surfaceInfo.width = static_cast<int>(width);
+  surfaceInfo.height = static_cast<int>(height);
+  surfaceInfo.framesInFlight = framesInFlight;
+  renderer->attach(surfaceInfo, false);
+  checkAttached(*renderer);
+
+  scene.setup(*renderer);
+  renderer->setRecordThreads(recordThreads);
+
+  std::vector<sFrameSample> samples;
+  renderer->runFrames(options.warmup, samples);
+  samples.clear();
+  renderer->runFrames(options.frames, samples);
+
+  AllocatorStats memory = renderer->getMemoryStats();
+  std::cerr << "  device memory objects " << memory.deviceMemoryCount << ", reserved " << memory.bytesReserved
+            << " B, used " << memory.bytesUsed << " B, wasted " << memory.bytesWasted << " B" << std::endl;
+
+  renderer->detach();
+
+  RunResult result;
+  result.name = scene.name + "_" + std::to_string(width) + "x" + std::to_string(height) + "_fif" +
+                std::to_string(framesInFlight);
+  if (recordThreads > 1) {
+    // Single threaded runs keep their old name so existing baselines still match.
+    result.name += "_rt" + std::to_string(recordThreads);
+  }
+  result.scene = scene.name;
+  result.width = width;
+  result.height = height;
+  result.framesInFlight = framesInFlight;
+  result.recordThreads = recordThreads;
+  result.frames = options.frames;
+
+  std::vector<double> cpuFrame, submitToPresent, gpuFrame, cpuRecord, acquireWait;
+  for (const sFrameSample &sample : samples) {
+    cpuFrame.push_back(sample.cpuFrame);
+    submitToPresent.push_back(sample.submitToPresent);
+    gpuFrame.push_back(sample.gpuFrame);
+    cpuRecord.push_back(sample.cpuRecord);
+    acquireWait.push_back(sample.acquireWait);
+  }
+  result.metrics["cpuFrameMs"] = Percentiles::fromSeconds(cpuFrame);
+  result.metrics["submitToPresentMs"] = Percentiles::fromSeconds(submitToPresent);
+  result.metrics["gpuFrameMs"] = Percentiles::fromSeconds(gpuFrame);
+  result.metrics["cpuRecordMs"] = Percentiles::fromSeconds(cpuRecord);
+  result.metrics["acquireWaitMs"] = Percentiles::fromSeconds(acquireWait);
+  if (!coldAttach.empty()) {
+    result.metrics["coldAttachMs"] = Percentiles::fromSeconds(coldAttach);
+    result.metrics["warmAttachMs"] = Percentiles::fromSeconds(warmAttach);
+  }
+
+  return result;
+}
+
+// Times cullSpheres for count spheres scattered over the plane the grids lie in, seen from the default camera, on
+// every path this CPU supports. One cull per measured frame; only the host is involved.
+static std::vector<RunResult> runCullBenchmark(const Options &options, uint32_t count)
+{
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<float> position(-10.0f, 10.0f);
+  BoundsStore bounds;
+  bounds.resize(count);
+  for (uint32_t i = 0; i < count; i++) {
+    bounds.set(i, glm::vec3(position(rng), position(rng), 0.0f), 0.05f);
+  }
+
+  Camera camera;
+  glm::mat4 view = glm::lookAt(camera.eye, camera.target, camera.up);
+  glm::mat4 proj = glm::perspective(camera.fovY, 16.0f / 9.0f, camera.nearPlane, camera.farPlane);
+  proj[1][1] *= -1;
+  Frustum frustum(proj * view);
+
+  std::vector<RunResult> results;
+  std::vector<uint32_t> visible;
+  for (CullPath path : { CullPath::Scalar, CullPath::Sse, CullPath::Avx2, CullPath::Neon }) {
+    if (!cullPathSupported(path)) {
+      continue;
+    }
+
+    for (uint32_t i = 0; i < options.warmup; i++) {
+      cullSpheres(bounds, frustum, visible, path);
+    }
+
+    std::vector<double> cull;
+    for (uint32_t i = 0; i < options.frames; i++) {
+      Timing<std::chrono::duration<double, std::ratio<1>>> t;
+      cullSpheres(bounds, frustum, visible, path);
+      cull.push_back(t.tock().count());
+    }
+    std::cerr << "  " << cullPathName(path) << ": " << visible.size() << " of " << count << " visible" << std::endl;
+
+    RunResult result;
+    result.name = std::string("cull_") + cullPathName(path) + "_" + std::to_string(count);
+    result.scene = "cull";
+    result.frames = options.frames;
+    result.metrics["cullMs"] = Percentiles::fromSeconds(cull);
+    results.push_back(result);
+  }
+  return results;
+}
+
+// Times a count-node hierarchy shaped like an editor scene: a few roots over long, mostly deep branches. World
+// matrices go into a plain array standing in for a mapped buffer. Measures recomputing everything, moving the first
+// root (its whole subtree) and moving the last leaf, plus a naive full update that multiplies glm matrices node by
+// node, for comparison.
+static RunResult runTransformBenchmark(const Options &options, uint32_t count)
+{
+  count = std::max(count, 1u);
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+  auto randomTransform = [&]() {
+    Transform t;
+    t.translation = glm::vec3(unit(rng), unit(rng), unit(rng));
+    t.rotation = glm::angleAxis(unit(rng) * 6.28f, glm::normalize(glm::vec3(unit(rng), unit(rng), 1.0f)));
+    return t;
+  };
+
+  TransformHierarchy hierarchy;
+  std::vector<TransformHierarchy::NodeId> path; // From a root to the last node, so every add is an append
+  for (uint32_t i = 0; i < count; i++) {
+    size_t depth = path.size();
+    if (unit(rng) < 0.1f) {
+      depth = static_cast<size_t>(unit(rng) * path.size());
+    }
+    path.resize(depth);
+    TransformHierarchy::NodeId parent = path.empty() ? TransformHierarchy::NO_PARENT : path.back();
+    path.push_back(hierarchy.addNode(parent, randomTransform()));
+  }
+
+  std::vector<glm::mat4> mapped(count);
+  auto sink = [&](TransformHierarchy::NodeId id, const glm::mat4 &world) { mapped[id] = world; };
+  hierarchy.update(sink);
+
+  std::vector<double> full, root, leaf, naive;
+  std::vector<glm::mat4> naiveWorlds(count);
+  Transform moved = randomTransform();
+  for (uint32_t i = 0; i < options.warmup + options.frames; i++) {
+    Timing<std::chrono::duration<double, std::ratio<1>>> t;
+    hierarchy.markAllDirty();
+    hierarchy.update(sink);
+    double fullTime = t.tock().count();
+
+    hierarchy.setLocal(0, moved);
+    hierarchy.update(sink);
+    double rootTime = t.tock().count();
+
+    hierarchy.setLocal(count - 1, moved);
+    hierarchy.update(sink);
+    double leafTime = t.tock().count();
+
+    // Ids were handed out in creation order, so parents come first here too.
+    for (uint32_t id = 0; id < count; id++) {
+      glm::mat4 local = glm::translate(glm::mat4(1.0f), hierarchy.getLocal(id).translation) *
+                        glm::mat4_cast(hierarchy.getLocal(id).rotation) *
+                        glm::scale(glm::mat4(1.0f), hierarchy.getLocal(id).scale);
+      TransformHierarchy::NodeId parent = hierarchy.getParent(id);
+      naiveWorlds[id] = parent == TransformHierarchy::NO_PARENT ? local : naiveWorlds[parent] * local;
+    }
+    double naiveTime = t.tock().count();
+
+    if (i >= options.warmup) {
+      full.push_back(fullTime);
+      root.push_back(rootTime);
+      leaf.push_back(leafTime);
+      naive.push_back(naiveTime);
+    }
+  }
+
+  RunResult result;
+  result.name = "transforms_" + std::to_string(count);
+  result.scene = "transforms";
+  result.frames = options.frames;
+  result.metrics["fullUpdateMs"] = Percentiles::fromSeconds(full);
+  result.metrics["rootMoveMs"] = Percentiles::fromSeconds(root);
+  result.metrics["leafMoveMs"] = Percentiles::fromSeconds(leaf);
+  result.metrics["naiveFullUpdateMs"] = Percentiles::fromSeconds(naive);
+  return result;
+}
+
+// Times the job system with threads threads, the calling one included: a million 4x4 products in ranges of 4096
+// (jobsMs, for scaling over thread counts) and 10000 empty ranges (emptyJobsMs, the cost of scheduling alone).
+static RunResult runJobBenchmark(const Options &options, uint32_t threads)
+{
+  JobSystem jobs(std::max(threads, 1u) - 1);
+  const size_t count = 1000000;
+  std::vector<glm::mat4> matrices(count, glm::rotate(glm::mat4(1.0f), 0.1f, glm::vec3(0.0f, 0.0f, 1.0f)));
+  std::vector<glm::mat4> results(count);
+  glm::mat4 parent = glm::translate(glm::mat4(1.0f), glm::vec3(1.0f, 2.0f, 3.0f));
+
+  std::vector<double> work, empty;
+  for (uint32_t i = 0; i < options.warmup + options.frames; i++) {
+    Timing<std::chrono::duration<double, std::ratio<1>>> t;
+    jobs.parallelFor(
+        count,
+        4096,
+        [&](size_t begin, size_t end) {
+          for (size_t m = begin; m < end; m++) {
+            mat4simd::multiply(&parent[0][0], &matrices[m][0][0], &results[m][0][0]);
+          }
+        },
+        "multiply"
+    );
+    double workTime = t.tock().count();
+
+    jobs.parallelFor(10000, 1, [](size_t, size_t) {}, "empty");
+    double emptyTime = t.tock().count();
+
+    if (i >= options.warmup) {
+      work.push_back(workTime);
+      empty.push_back(emptyTime);
+    }
+  }
+
+  RunResult result;
+  result.name = "jobs_" + std::to_string(threads);
+  result.scene = "jobs";
+  result.recordThreads = threads;
+  result.frames = options.frames;
+  result.metrics["jobsMs"] = Percentiles::fromSeconds(work);
+  result.metrics["emptyJobsMs"] = Percentiles::fromSeconds(empty);
+  return result;
+}
+
+// Times replacing the scene mesh of a headless renderer with a grid mesh of about vertexCount vertices, the way an
+// application does it: loadMesh maps and checks the .vkmesh on the calling thread (loadMs), and the next frame swaps
+// it in, copies both streams from the mapping into staging memory and uploads them (uploadFrameMs, until the device is
+// idle again, so it includes drawing that one frame). loadMBps is the file size over both together. The file stays in
+// the page cache, so this is the warm case.
+static RunResult runMeshLoadBenchmark(const Options &options, uint32_t vertexCount)
+{
+  uint32_t side = std::max(static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<double>(vertexCount)))), 2u);
+  std::vector<Vertex> meshVertices;
+  meshVertices.reserve(side * side);
+  for (uint32_t y = 0; y < side; y++) {
+    for (uint32_t x = 0; x < side; x++) {
+      glm::vec2 pos = glm::vec2(x, y) / static_cast<float>(side - 1) - 0.5f;
+      meshVertices.push_back({ pos, glm::vec3(pos + 0.5f, 1.0f) });
+    }
+  }
+  std::vector<uint32_t> meshIndices;
+  meshIndices.reserve((side - 1) * (side - 1) * 6);
+  for (uint32_t y = 0; y + 1 < side; y++) {
+    for (uint32_t x = 0; x + 1 < side; x++) {
+      uint32_t i = y * side + x;
+      meshIndices.insert(meshIndices.end(), { i, i + 1, i + side + 1, i + side + 1, i + side, i });
+    }
+  }
+
+  std::string fileName = "benchmark_mesh_" + std::to_string(vertexCount) + ".vkmesh";
+  std::string path = (std::filesystem::temp_directory_path() / fileName).string();
+  writeMeshFile(path, meshVertices.data(), sizeof(Vertex), static_cast<uint32_t>(meshVertices.size()),
+                meshIndices.data(), 4, static_cast<uint32_t>(meshIndices.size()), glm::length(glm::vec2(0.5f)));
+  double megabytes = std::filesystem::file_size(path) / (1024.0 * 1024.0);
+
+  auto [width, height] = options.resolutions.front();
+  auto renderer = std::make_unique<Renderer>(true, options.pipelineCache);
+
+  SurfaceInfo surfaceInfo {};
+  surfaceInfo.width = static_cast<int>(width);
+  surfaceInfo.height = static_cast<int>(height);
+  surfaceInfo.framesInFlight = options.framesInFlight.front();
+  renderer->attach(surfaceInfo, false);
+  checkAttached(*renderer);
+
+  std::vector<double> load, uploadFrame, total;
+  std::vector<sFrameSample> frames;
+  for (uint32_t i = 0; i < options.warmup + options.frames; i++) {
+    Timing<std::chrono::duration<double, std::ratio<1>>> t;
+    renderer->loadMesh(path);
+    double loadTime = t.tock().count();
+    renderer->runFrames(1, frames);
+    double uploadTime = t.tock().count();
+
+    if (i >= options.warmup) {
+      load.push_back(loadTime);
+      uploadFrame.push_back(uploadTime);
+      total.push_back(loadTime + uploadTime);
+    }
+  }
+
+  // The renderer keeps the last mesh mapped, and a mapped file can't be removed on Windows.
+  renderer->detach();
+  renderer.reset();
+  std::filesystem::remove(path);
+
+  RunResult result;
+  result.name = "mesh_load_" + std::to_string(vertexCount);
+  result.scene = "mesh_load";
+  result.width = width;
+  result.height = height;
+  result.framesInFlight = surfaceInfo.framesInFlight;
+  result.frames = options.frames;
+  result.metrics["loadMs"] = Percentiles::fromSeconds(load);
+  result.metrics["uploadFrameMs"] = Percentiles::fromSeconds(uploadFrame);
+  result.metrics["loadMBps"] = Percentiles::throughput(megabytes, Percentiles::fromSeconds(total));
+
+  std::cerr << "  " << megabytes << " MB at " << result.metrics["loadMBps"].p50 << " MB/s (p50)" << std::endl;
+  return result;
+}
+
+int main(int argc, char **argv)
+{
+  Options options;
+  try {
+    options = parseOptions(argc, argv);
+  }
+  catch (std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    printUsage();
+    return 2;
+  }
+
+  std::vector<RunResult> results;
+  try {
+    for (uint32_t count : options.cullObjects) {
+      std::cerr << "Running CPU culling of " << count << " spheres" << std::endl;
+      for (RunResult &result : runCullBenchmark(options, count)) {
+        results.push_back(result);
+      }
+    }
+
+    for (uint32_t count : options.transformNodes) {
+      std::cerr << "Running a transform hierarchy of " << count << " nodes" << std::endl;
+      results.push_back(runTransformBenchmark(options, count));
+    }
+
+    for (uint32_t threads : options.jobThreads) {
+      std::cerr << "Running the job system on " << threads << " threads" << std::endl;
+      results.push_back(runJobBenchmark(options, threads));
+    }
+
+    for (uint32_t count : options.meshVertices) {
+      std::cerr << "Loading a mesh of " << count << " vertices" << std::endl;
+      results.push_back(runMeshLoadBenchmark(options, count));
+    }
+
+    for (const std::string &sceneName : options.scenes) {
+      auto scene = std::find_if(scenes.begin(), scenes.end(), [&](const BenchmarkScene &s) { return s.name == sceneName; });
+      if (scene == scenes.end()) {
+        throw std::runtime_error("unknown scene " + sceneName);
+      }
+
+      for (auto [width, height] : options.resolutions) {
+        for (uint32_t framesInFlight : options.framesInFlight) {
+          for (uint32_t recordThreads : options.recordThreads) {
+            std::cerr << "Running " << sceneName << " " << width << "x" << height << " fif " << framesInFlight
+                      << " record threads " << recordThreads << std::endl;
+            results.push_back(runBenchmark(options, *scene, width, height, framesInFlight, recordThreads));
+          }
+        }
+      }
+    }
+  }
+  catch (std::exception &e) {
+    std::cerr << "Benchmark failed: " << e.what() << std::endl;
+    return 2;
+  }
+
+  if (options.output.empty()) {
+    report::writeJson(std::cout, results);
+  }
+  else {
+    std::ofstream file(options.output);
+    report::writeJson(file, results);
+  }
+
+  if (!options.baseline.empty()) {
+    try {
+      auto baseline = report::readJson(options.baseline);
+      int regressions = report::compare(results, baseline, options.threshold, options.minDeltaMs, std::cerr);
+      if (regressions > 0) {
+        std::cerr << regressions << " regression(s) against " << options.baseline << std::endl;
+        return 1;
+      }
+      std::cerr << "No regressions against " << options.baseline << std::endl;
+    }
+    catch (std::exception &e) {
+      std::cerr << "Baseline comparison failed: " << e.what() << std::endl;
+      return 2;
+    }
+  }
+
+  return 0;
+}
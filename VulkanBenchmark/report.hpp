@@ -0,0 +1,334 @@
+#pragma once
+#ifndef REPORT_HH
+#define REPORT_HH
+
+#include <algorithm>
+#include <cmath>
+#include <cctype>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Metrics named ...MBps are throughputs in MB/s, where lower is worse. Everything else is a time.
+inline bool isThroughput(const std::string &metric)
+{
+  return metric.size() >= 4 && metric.compare(metric.size() - 4, 4, "MBps") == 0;
+}
+
+// Percentile summary of one metric, in milliseconds, or MB/s for a throughput.
+struct Percentiles {
+  double p50 = 0;
+  double p95 = 0;
+  double p99 = 0;
+  double max = 0;
+
+  // Nearest-rank percentiles. Input is in seconds, like everything the renderer reports.
+  static Percentiles fromSeconds(std::vector<double> values)
+  {
+    Percentiles result;
+    if (values.empty()) {
+      return result;
+    }
+
+    std::sort(values.begin(), values.end());
+    auto rank = [&values](double p) {
+      size_t index = static_cast<size_t>(std::ceil(p * values.size()));
+      return values[std::clamp<size_t>(index, 1, values.size()) - 1] * 1000.0;
+    };
+
+    result.p50 = rank(0.50);
+    result.p95 = rank(0.95);
+    result.p99 = rank(0.99);
+    result.max = values.back() * 1000.0;
+    return result;
+  }
+
+  // The throughput of moving megabytes in the times of ms. Each percentile stays the slow end: p95 is the rate of
+  // the 95th percentile time, max that of the slowest.
+  static Percentiles throughput(double megabytes, const Percentiles &ms)
+  {
+    auto rate = [megabytes](double milliseconds) { return milliseconds > 0 ? megabytes / (milliseconds / 1000.0) : 0; };
+
+    Percentiles result;
+    result.p50 = rate(ms.p50);
+    result.p95 = rate(ms.p95);
+    result.p99 = rate(ms.p99);
+    result.max = rate(ms.max);
+    return result;
+  }
+};
+
+struct RunResult {
+  std::string name;
+  std::string scene;
+  uint32_t width = 0;
+  uint32_t height = 0;
+  uint32_t framesInFlight = 0;
+  uint32_t recordThreads = 1;
+  uint32_t frames = 0;
+
+  // Metric name -> percentiles. Kept as a map so new metrics show up in the report and the comparison without
+  // touching either.
+  std::map<std::string, Percentiles> metrics;
+};
+
+namespace report {
+
+inline void writePercentiles(std::ostream &out, const Percentiles &p)
+{
+  out << "{ \"p50\": " << p.p50 << ", \"p95\": " << p.p95 << ", \"p99\": " << p.p99 << ", \"max\": " << p.max << " }";
+}
+
+inline void writeJson(std::ostream &out, const std::vector<RunResult> &runs)
+{
+  out << std::fixed << std::setprecision(4);
+  out << "{\n  \"runs\": [\n";
+  for (size_t i = 0; i < runs.size(); i++) {
+    const RunResult &run = runs[i];
+    out << "    {\n";
+    out << "      \"name\": \"" << run.name << "\",\n";
+    out << "      \"scene\": \"" << run.scene << "\",\n";
+    out << "      \"width\": " << run.width << ",\n";
+    out << "      \"height\": " << run.height << ",\n";
+    out << "      \"framesInFlight\": " << run.framesInFlight << ",\n";
+    out << "      \"recordThreads\": " << run.recordThreads << ",\n";
+    out << "      \"frames\": " << run.frames << ",\n";
+    out << "      \"metrics\": {\n";
+    size_t m = 0;
+    for (const auto &[metric, percentiles] : run.metrics) {
+      out << "        \"" << metric << "\": ";
+      writePercentiles(out, percentiles);
+      out << (++m < run.metrics.size() ? ",\n" : "\n");
+    }
+    out << "      }\n";
+    out << "    }" << (i + 1 < runs.size() ? ",\n" : "\n");
+  }
+  out << "  ]\n}\n";
+}
+
+// Just enough JSON to read back what writeJson produces.
+class JsonValue {
+public:
+  enum class Type { Null, Number, String, Array, Object };
+
+  Type type = Type::Null;
+  double number = 0;
+  std::string string;
+  std::vector<JsonValue> array;
+  std::map<std::string, JsonValue> object;
+
+  const JsonValue &operator[](const std::string &key) const
+  {
+    static const JsonValue null;
+    auto it = object.find(key);
+    return it == object.end() ? null : it->second;
+  }
+
+  static JsonValue parse(const std::string &text)
+  {
+    size_t pos = 0;
+    JsonValue value = parseValue(text, pos);
+    skipWhitespace(text, pos);
+    if (pos != text.size()) {
+      throw std::runtime_error("trailing characters in JSON!");
+    }
+    return value;
+  }
+
+private:
+  static void skipWhitespace(const std::string &text, size_t &pos)
+  {
+    while (pos < text.size() && std::isspace(static_cast<unsigned char>(text[pos]))) {
+      pos++;
+    }
+  }
+
+  static void expect(const std::string &text, size_t &pos, char c)
+  {
+    skipWhitespace(text, pos);
+    if (pos >= text.size() || text[pos] != c) {
+      throw std::runtime_error(std::string("malformed JSON, expected '") + c + "'!");
+    }
+    pos++;
+  }
+
+  static std::string parseString(const std::string &text, size_t &pos)
+  {
+    expect(text, pos, '"');
+    std::string result;
+    while (pos < text.size() && text[pos] != '"') {
+      if (text[pos] == '\\' && pos + 1 < text.size()) {
+        pos++;
+      }
+      result += text[pos++];
+    }
+    expect(text, pos, '"');
+    return result;
+  }
+
+  static JsonValue parseValue(const std::string &text, size_t &pos)
+  {
+    skipWhitespace(text, pos);
+    if (pos >= text.size()) {
+      throw std::runtime_error("unexpected end of JSON!");
+    }
+
+    JsonValue value;
+    char c = text[pos];
+    if (c == '{') {
+      value.type = Type::Object;
+      pos++;
+      skipWhitespace(text, pos);
+      if (text[pos] == '}') {
+        pos++;
+        return value;
+      }
+      while (true) {
+        std::string key = parseString(text, pos);
+        expect(text, pos, ':');
+        value.object[key] = parseValue(text, pos);
+        skipWhitespace(text, pos);
+        if (text[pos] == ',') {
+          pos++;
+          continue;
+        }
+        expect(text, pos, '}');
+        return value;
+      }
+    }
+    if (c == '[') {
+      value.type = Type::Array;
+      pos++;
+      skipWhitespace(text, pos);
+      if (text[pos] == ']') {
+        pos++;
+        return value;
+      }
+      while (true) {
+        value.array.push_back(parseValue(text, pos));
+        skipWhitespace(text, pos);
+        if (text[pos] == ',') {
+          pos++;
+          continue;
+        }
+        expect(text, pos, ']');
+        return value;
+      }
+    }
+    if (c == '"') {
+      value.type = Type::String;
+      value.string = parseString(text, pos);
+      return value;
+    }
+    if (text.compare(pos, 4, "null") == 0) {
+      pos += 4;
+      return value;
+    }
+
+    size_t end = pos;
+    while (end < text.size() && (std::isdigit(static_cast<unsigned char>(text[end])) || text[end] == '-' ||
+                                 text[end] == '+' || text[end] == '.' || text[end] == 'e' || text[end] == 'E')) {
+      end++;
+    }
+    if (end == pos) {
+      throw std::runtime_error("malformed JSON value!");
+    }
+    value.type = Type::Number;
+    value.number = std::stod(text.substr(pos, end - pos));
+    pos = end;
+    return value;
+  }
+};
+
+inline std::vector<RunResult> readJson(const std::string &filename)
+{
+  std::ifstream file(filename);
+  if (!file.is_open()) {
+    throw std::runtime_error("failed to open baseline file!");
+  }
+  std::stringstream buffer;
+  buffer << file.rdbuf();
+
+  JsonValue root = JsonValue::parse(buffer.str());
+
+  std::vector<RunResult> runs;
+  for (const JsonValue &run : root["runs"].array) {
+    RunResult result;
+    result.name = run["name"].string;
+    result.scene = run["scene"].string;
+    result.width = static_cast<uint32_t>(run["width"].number);
+    result.height = static_cast<uint32_t>(run["height"].number);
+    result.framesInFlight = static_cast<uint32_t>(run["framesInFlight"].number);
+    result.recordThreads = std::max(static_cast<uint32_t>(run["recordThreads"].number), 1u);
+    result.frames = static_cast<uint32_t>(run["frames"].number);
+    for (const auto &[metric, value] : run["metrics"].object) {
+      Percentiles p;
+      p.p50 = value["p50"].number;
+      p.p95 = value["p95"].number;
+      p.p99 = value["p99"].number;
+      p.max = value["max"].number;
+      result.metrics[metric] = p;
+    }
+    runs.push_back(result);
+  }
+  return runs;
+}
+
+// Compares every percentile of every metric present in both reports. A time regresses when it is more than threshold
+// (relative) slower than the baseline and also slower by at least minDeltaMs, which keeps sub-millisecond noise on
+// tiny scenes from failing the run. A throughput regresses when it drops by more than threshold. Returns the number of
+// regressions.
+inline int compare(
+    const std::vector<RunResult> &current,
+    const std::vector<RunResult> &baseline,
+    double threshold,
+    double minDeltaMs,
+    std::ostream &out
+)
+{
+  int regressions = 0;
+  for (const RunResult &run : current) {
+    auto base = std::find_if(baseline.begin(), baseline.end(), [&run](const RunResult &b) { return b.name == run.name; });
+    if (base == baseline.end()) {
+      out << run.name << ": no baseline, skipped" << std::endl;
+      continue;
+    }
+
+    for (const auto &[metric, p] : run.metrics) {
+      auto it = base->metrics.find(metric);
+      if (it == base->metrics.end()) {
+        continue;
+      }
+
+      const std::pair<const char *, std::pair<double, double>> values[] = {
+        { "p50", { p.p50, it->second.p50 }},
+        { "p95", { p.p95, it->second.p95 }},
+        { "p99", { p.p99, it->second.p99 }},
+        { "max", { p.max, it->second.max }},
+      };
+
+      bool throughput = isThroughput(metric);
+      const char *unit = throughput ? " MB/s" : " ms";
+      for (const auto &[label, pair] : values) {
+        auto [now, before] = pair;
+        bool regressed = throughput ? now < before * (1.0 - threshold)
+                                    : now > before * (1.0 + threshold) && now - before >= minDeltaMs;
+        if (regressed) {
+          out << run.name << ": " << metric << " " << label << " regressed " << before << unit << " -> " << now << unit
+              << std::endl;
+          regressions++;
+        }
+      }
+    }
+  }
+  return regressions;
+}
+
+} // namespace report
+
+#endif
@@ -0,0 +1,281 @@
+#pragma once
+#ifndef ALLOCATOR_HH
+#define ALLOCATOR_HH
+
+#include <vulkan/vulkan.hpp>
+
+#include <algorithm>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "device.hpp"
+
+// Linear resources are buffers and linear images, optimal resources are optimally tiled images. The two may not share
+// a bufferImageGranularity page.
+enum class ResourceKind { Linear, Optimal };
+
+struct Allocation {
+  vk::DeviceMemory memory;
+  vk::DeviceSize offset = 0;
+  vk::DeviceSize size = 0;
+  void *mapped = nullptr; // Already offset. Only set for host visible memory.
+
+  uint32_t memoryType = 0;
+  int32_t block = -1; // Index into the block list of memoryType, or DEDICATED
+
+  static const int32_t DEDICATED = -1;
+
+  explicit operator bool() const { return static_cast<bool>(memory); }
+};
+
+struct AllocatorStats {
+  uint64_t deviceMemoryCount = 0; // Live vkAllocateMemory objects
+  uint64_t bytesReserved = 0;     // Sum of all device memory objects
+  uint64_t bytesUsed = 0;         // Sum of the sizes that were asked for
+  uint64_t bytesWasted = 0;       // Padding from granularity rounding
+  uint64_t allocationCount = 0;   // Live sub-allocations (including dedicated ones)
+};
+
+// Sub-allocates buffers and images out of large per-memory-type blocks instead of calling allocateMemory for each
+// resource. Requests larger than half a block get their own dedicated allocation. Host visible blocks are mapped once
+// at creation and stay mapped, so Allocation::mapped can be used directly.
+//
+// All public functions are thread safe.
+class MemoryAllocator {
+public:
+  MemoryAllocator(Device *device_, vk::DeviceSize blockSize_ = 64ull * 1024 * 1024)
+      : device(device_), blockSize(blockSize_)
+  {
+    vk::PhysicalDevice &physicalDevice = *device->getPhysicalDevice();
+    memoryProperties = physicalDevice.getMemoryProperties();
+    bufferImageGranularity = physicalDevice.getProperties().limits.bufferImageGranularity;
+    blocks.resize(memoryProperties.memoryTypeCount);
+  }
+
+  ~MemoryAllocator()
+  {
+    for (auto &typeBlocks : blocks) {
+      for (auto &block : typeBlocks) {
+        freeBlock(block);
+      }
+    }
+  }
+
+  Allocation allocate(const vk::MemoryRequirements &requirements, vk::MemoryPropertyFlags properties,
+                      ResourceKind kind = ResourceKind::Linear)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    uint32_t memoryType = device->findMemoryType(requirements.memoryTypeBits, properties);
+
+    vk::DeviceSize alignment = requirements.alignment;
+    vk::DeviceSize size = requirements.size;
+    if (kind == ResourceKind::Optimal) {
+      // Keep optimal resources on pages of their own. Their start is page aligned and their size is rounded up to a
+      // whole page, so a neighbouring linear resource can never end up on the same page.
+      alignment = std::max(alignment, bufferImageGranularity);
+      size = alignUp(size, bufferImageGranularity);
+    }
+
+    Allocation allocation;
+    if (size > blockSize / 2) {
+      allocation = allocateDedicated(memoryType, requirements.size);
+    }
+    else {
+      allocation = allocateFromBlocks(memoryType, size, alignment);
+    }
+
+    vk::DeviceSize waste = allocation.size - requirements.size;
+    if (allocation.block >= 0) {
+      blocks[memoryType][allocation.block].padding[allocation.offset] = waste;
+    }
+
+    stats.bytesUsed += requirements.size;
+    stats.bytesWasted += waste;
+    stats.allocationCount++;
+    return allocation;
+  }
+
+  void free(Allocation &allocation)
+  {
+    if (!allocation) {
+      allocation = {};
+      return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    stats.allocationCount--;
+    if (allocation.block == Allocation::DEDICATED) {
+      stats.bytesUsed -= allocation.size;
+      stats.bytesReserved -= allocation.size;
+      stats.deviceMemoryCount--;
+      (*device)->freeMemory(allocation.memory);
+      allocation = {};
+      return;
+    }
+
+    Block &block = blocks[allocation.memoryType][allocation.block];
+    vk::DeviceSize waste = block.padding[allocation.offset];
+    stats.bytesUsed -= allocation.size - waste;
+    stats.bytesWasted -= waste;
+    block.padding.erase(allocation.offset);
+    insertFreeRange(block, allocation.offset, allocation.size);
+    allocation = {};
+  }
+
+  AllocatorStats getStats()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+  }
+
+  void bindBuffer(vk::Buffer buffer, const Allocation &allocation)
+  {
+    (*device)->bindBufferMemory(buffer, allocation.memory, allocation.offset);
+  }
+
+  void bindImage(vk::Image image, const Allocation &allocation)
+  {
+    (*device)->bindImageMemory(image, allocation.memory, allocation.offset);
+  }
+
+private:
+  struct Block {
+    vk::DeviceMemory memory;
+    vk::DeviceSize size = 0;
+    uint32_t memoryType = 0;
+    uint8_t *mapped = nullptr;
+
+    std::map<vk::DeviceSize, vk::DeviceSize> freeRanges; // Offset -> size, sorted so neighbours can be merged
+    std::map<vk::DeviceSize, vk::DeviceSize> padding;    // Live allocation offset -> granularity rounding, for stats
+  };
+
+  Device *device;
+  vk::DeviceSize blockSize;
+  vk::DeviceSize bufferImageGranularity = 1;
+  vk::PhysicalDeviceMemoryProperties memoryProperties;
+
+  std::vector<std::vector<Block>> blocks; // Per memory type
+
+  AllocatorStats stats;
+  std::mutex mutex;
+
+  static vk::DeviceSize alignUp(vk::DeviceSize value, vk::DeviceSize alignment)
+  {
+    return alignment > 1 ? (value + alignment - 1) / alignment * alignment : value;
+  }
+
+  bool isHostVisible(uint32_t memoryType) const
+  {
+    return static_cast<bool>(
+        memoryProperties.memoryTypes[memoryType].propertyFlags & vk::MemoryPropertyFlagBits::eHostVisible
+    );
+  }
+
+  Block createBlock(uint32_t memoryType, vk::DeviceSize size)
+  {
+    vk::MemoryAllocateInfo allocInfo = {};
+    allocInfo.allocationSize = size;
+    allocInfo.memoryTypeIndex = memoryType;
+
+    Block block;
+    try {
+      block.memory = (*device)->allocateMemory(allocInfo);
+    }
+    catch (vk::SystemError) {
+      throw std::runtime_error("failed to allocate device memory block!");
+    }
+    block.size = size;
+    block.memoryType = memoryType;
+    if (isHostVisible(memoryType)) {
+      block.mapped = static_cast<uint8_t *>((*device)->mapMemory(block.memory, 0, VK_WHOLE_SIZE));
+    }
+
+    stats.deviceMemoryCount++;
+    stats.bytesReserved += size;
+    return block;
+  }
+
+  void freeBlock(Block &block)
+  {
+    if (block.mapped) {
+      (*device)->unmapMemory(block.memory);
+    }
+    (*device)->freeMemory(block.memory);
+    stats.deviceMemoryCount--;
+    stats.bytesReserved -= block.size;
+    block = {};
+  }
+
+  Allocation makeAllocation(Block &block, vk::DeviceSize offset, vk::DeviceSize size, int32_t blockIndex)
+  {
+    Allocation allocation;
+    allocation.memory = block.memory;
+    allocation.offset = offset;
+    allocation.size = size;
+    allocation.mapped = block.mapped ? block.mapped + offset : nullptr;
+    allocation.memoryType = block.memoryType;
+    allocation.block = blockIndex;
+    return allocation;
+  }
+
+  Allocation allocateDedicated(uint32_t memoryType, vk::DeviceSize size)
+  {
+    Block block = createBlock(memoryType, size);
+    return makeAllocation(block, 0, size, Allocation::DEDICATED);
+  }
+
+  // First fit. Any alignment padding in front of the allocation stays in the free list.
+  Allocation allocateFromBlocks(uint32_t memoryType, vk::DeviceSize size, vk::DeviceSize alignment)
+  {
+    auto &typeBlocks = blocks[memoryType];
+    for (size_t i = 0; i < typeBlocks.size(); i++) {
+      Block &block = typeBlocks[i];
+      for (auto it = block.freeRanges.begin(); it != block.freeRanges.end(); ++it) {
+        vk::DeviceSize rangeOffset = it->first;
+        vk::DeviceSize rangeSize = it->second;
+        vk::DeviceSize offset = alignUp(rangeOffset, alignment);
+        if (offset + size > rangeOffset + rangeSize) {
+          continue;
+        }
+
+        block.freeRanges.erase(it);
+        if (offset > rangeOffset) {
+          block.freeRanges[rangeOffset] = offset - rangeOffset;
+        }
+        if (offset + size < rangeOffset + rangeSize) {
+          block.freeRanges[offset + size] = rangeOffset + rangeSize - (offset + size);
+        }
+        return makeAllocation(block, offset, size, static_cast<int32_t>(i));
+      }
+    }
+
+    Block &block = typeBlocks.emplace_back(createBlock(memoryType, blockSize));
+    if (size < blockSize) {
+      block.freeRanges[size] = blockSize - size;
+    }
+    return makeAllocation(block, 0, size, static_cast<int32_t>(typeBlocks.size() - 1));
+  }
+
+  void insertFreeRange(Block &block, vk::DeviceSize offset, vk::DeviceSize size)
+  {
+    auto next = block.freeRanges.lower_bound(offset);
+    if (next != block.freeRanges.end() && offset + size == next->first) {
+      size += next->second;
+      next = block.freeRanges.erase(next);
+    }
+    if (next != block.freeRanges.begin()) {
+      auto prev = std::prev(next);
+      if (prev->first + prev->second == offset) {
+        prev->second += size;
+        return;
+      }
+    }
+    block.freeRanges[offset] = size;
+  }
+};
+
+#endif
@@ -13,13 +13,31 @@ SHAREDVULKAN_API Renderer *initEngine(DebugCallback debugCallback)
   }
 }
 
+SHAREDVULKAN_API Renderer *initHeadlessEngine(DebugCallback debugCallback)
+{
+  try {
+    Renderer *vulkan = new Renderer(debugCallback, true);
+    return vulkan;
+  }
+  catch (std::exception) {
+    return nullptr;
+  }
+}
+
 SHAREDVULKAN_API int attachRenderer(void *ptr, HWND handle)
 {
   Renderer *vulkan = static_cast<Renderer *>(ptr);
+  if (vulkan->isHeadless()) {
+    return -1;
+  }
+
+  // Physical pixels. Later changes come in through resizeRenderer.
+  RECT clientRect {};
+  GetClientRect(handle, &clientRect);
 
   SurfaceInfo surfaceInfo {};
-  surfaceInfo.height = 0; // We need to get these from Avalonia
-  surfaceInfo.width = 0;
+  surfaceInfo.width = clientRect.right - clientRect.left;
+  surfaceInfo.height = clientRect.bottom - clientRect.top;
 
   surfaceInfo.hwnd = handle;
   surfaceInfo.hinstance = GetModuleHandle(nullptr);
@@ -30,10 +48,115 @@ SHAREDVULKAN_API int attachRenderer(void *ptr, HWND handle)
   return 0;
 }
 
+SHAREDVULKAN_API int attachHeadlessRenderer(void *ptr, int width, int height)
+{
+  Renderer *vulkan = static_cast<Renderer *>(ptr);
+  if (!vulkan->isHeadless()) {
+    return -1;
+  }
+
+  SurfaceInfo surfaceInfo {};
+  surfaceInfo.width = width;
+  surfaceInfo.height = height;
+
+  vulkan->attach(surfaceInfo);
+
+  return 0;
+}
+
+SHAREDVULKAN_API int resizeRenderer(void *ptr, HWND handle, int width, int height, double dpiScale)
+{
+  Renderer *vulkan = static_cast<Renderer *>(ptr);
+  if (!vulkan || width < 0 || height < 0 || dpiScale <= 0) {
+    return -1;
+  }
+
+  vulkan->resize(handle, width, height, dpiScale);
+  return 0;
+}
+
+SHAREDVULKAN_API int setViewportCamera(void *ptr, HWND handle, const sCamera *camera)
+{
+  Renderer *vulkan = static_cast<Renderer *>(ptr);
+  if (!vulkan || !camera) {
+    return -1;
+  }
+
+  Camera viewCamera;
+  viewCamera.eye = glm::vec3(camera->eye[0], camera->eye[1], camera->eye[2]);
+  viewCamera.target = glm::vec3(camera->target[0], camera->target[1], camera->target[2]);
+  viewCamera.up = glm::vec3(camera->up[0], camera->up[1], camera->up[2]);
+  viewCamera.fovY = glm::radians(camera->fovYDegrees);
+  viewCamera.nearPlane = camera->nearPlane;
+  viewCamera.farPlane = camera->farPlane;
+  vulkan->setCamera(handle, viewCamera);
+  return 0;
+}
+
+SHAREDVULKAN_API int setFramePacing(void *ptr, int mode, double framesPerSecond)
+{
+  Renderer *vulkan = static_cast<Renderer *>(ptr);
+  if (!vulkan || mode < PACING_UNCAPPED || mode > PACING_DISPLAY || (mode == PACING_FIXED && framesPerSecond <= 0)) {
+    return -1;
+  }
+
+  vulkan->setFramePacing(static_cast<ePacingMode>(mode), framesPerSecond);
+  return 0;
+}
+
+SHAREDVULKAN_API int setOnDemandRendering(void *ptr, bool enabled, double keepAliveFramesPerSecond)
+{
+  Renderer *vulkan = static_cast<Renderer *>(ptr);
+  if (!vulkan || keepAliveFramesPerSecond < 0) {
+    return -1;
+  }
+
+  vulkan->setOnDemand(enabled, keepAliveFramesPerSecond);
+  return 0;
+}
+
+SHAREDVULKAN_API int setCpuCulling(void *ptr, bool enabled)
+{
+  Renderer *vulkan = static_cast<Renderer *>(ptr);
+  if (!vulkan) {
+    return -1;
+  }
+
+  vulkan->setCpuCulling(enabled);
+  return 0;
+}
+
+SHAREDVULKAN_API int loadMesh(void *ptr, const char *path)
+{
+  Renderer *vulkan = static_cast<Renderer *>(ptr);
+  if (!vulkan || !path) {
+    return -1;
+  }
+
+  try {
+    vulkan->loadMesh(path);
+  }
+  catch (std::exception) {
+    return -1;
+  }
+  return 0;
+}
+
+SHAREDVULKAN_API int requestRedraw(void *ptr)
+{
+  Renderer *vulkan = static_cast<Renderer *>(ptr);
+  if (!vulkan) {
+    return -1;
+  }
+
+  vulkan->requestRedraw();
+  return 0;
+}
+
 SHAREDVULKAN_API int detachRenderer(void *ptr, HWND handle)
 {
   Renderer *vulkan = static_cast<Renderer *>(ptr);
-  vulkan->detach();
+  vulkan->detach(handle);
   return 0;
 }
 
@@ -44,16 +167,13 @@ SHAREDVULKAN_API int destroyEngine(void *ptr) {
 }
 
 
-SHAREDVULKAN_API bool setPerformanceMonitorCallback(void *ptr, PerformanceMonitorCallback callback)
+SHAREDVULKAN_API int readPerfSamples(void *ptr, sFrameSample *buffer, int max)
 {
   Renderer *vulkan = static_cast<Renderer *>(ptr);
-  try {
-    vulkan->setMonitorCallback(callback);
-    return true;
-  }
-  catch (std::exception) {
-    return false;
+  if (!vulkan || !buffer || max <= 0) {
+    return 0;
   }
+  return static_cast<int>(vulkan->readPerfSamples(buffer, static_cast<size_t>(max)));
 }
 
 SHAREDVULKAN_API bool setSimpleCallback(void *ptr, SimpleCallback callback)
@@ -11,14 +11,32 @@ extern "C" {
 
   SHAREDVULKAN_API Renderer* initEngine(DebugCallback debugCallback);
 
+  SHAREDVULKAN_API Renderer* initHeadlessEngine(DebugCallback debugCallback);
+
   SHAREDVULKAN_API int attachRenderer(void* ptr, HWND handle);
 
+  SHAREDVULKAN_API int attachHeadlessRenderer(void* ptr, int width, int height);
+
+  SHAREDVULKAN_API int resizeRenderer(void* ptr, HWND handle, int width, int height, double dpiScale);
+
+  SHAREDVULKAN_API int setViewportCamera(void* ptr, HWND handle, const sCamera* camera);
+
+  SHAREDVULKAN_API int setFramePacing(void* ptr, int mode, double framesPerSecond);
+
+  SHAREDVULKAN_API int setOnDemandRendering(void* ptr, bool enabled, double keepAliveFramesPerSecond);
+
+  SHAREDVULKAN_API int setCpuCulling(void* ptr, bool enabled);
+
+  SHAREDVULKAN_API int loadMesh(void* ptr, const char* path);
+
+  SHAREDVULKAN_API int requestRedraw(void* ptr);
+
   SHAREDVULKAN_API int detachRenderer(void* ptr, HWND handle);
 
   SHAREDVULKAN_API int destroyEngine(void* ptr);
 
 
-  SHAREDVULKAN_API bool setPerformanceMonitorCallback(void* ptr, PerformanceMonitorCallback callback);
+  SHAREDVULKAN_API int readPerfSamples(void* ptr, sFrameSample* buffer, int max);
 
   SHAREDVULKAN_API bool setSimpleCallback(void* ptr, SimpleCallback callback);
 }
\ No newline at end of file
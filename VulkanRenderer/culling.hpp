@@ -0,0 +1,320 @@
+#pragma once
+#ifndef CULLING_HH
+#define CULLING_HH
+
+#include <glm/glm.hpp>
+#include <vulkan/vulkan.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+#include "allocator.hpp"
+#include "device.hpp"
+#include "frustum_culling.hpp"
+#include "instances.hpp"
+#include "shader_library.hpp"
+
+// Compute shader of the culling pass. Relative to the working directory.
+const char *const CULL_SHADER = "shaders/cull_comp.spv";
+const uint32_t CULL_GROUP_SIZE = 64; // local_size_x of cull.comp
+
+// Push constants of cull.comp.
+struct CullConstants {
+  glm::vec4 planes[6];
+  uint32_t count;
+  float radius;
+};
+
+// What cull.comp writes for each viewport: one indexed indirect draw, then its draw count (0 or 1) for the count
+// variant of the draw.
+struct CullDraw {
+  vk::DrawIndexedIndirectCommand command;
+  uint32_t drawCount;
+};
+
+// Frustum culling of the instance list on the GPU. Per frame, a compute pass tests every instance's bounding sphere
+// against each viewport's frustum and compacts the survivors into that viewport's part of a visible instance buffer,
+// counting them in an indirect draw. The render pass then draws them with vkCmdDrawIndexedIndirectCount, or plain
+// vkCmdDrawIndexedIndirect without VK_KHR_draw_indirect_count. The CPU never looks at a single instance.
+//
+// Every frame in flight has its own output buffers and descriptor pool, so nothing here waits for the GPU. Render
+// thread only, except draw.
+class InstanceCuller {
+public:
+  InstanceCuller(Device *device_, MemoryAllocator *allocator_, ShaderLibrary *shaders, vk::PipelineCache cache,
+                 uint32_t framesInFlight)
+      : device(device_), allocator(allocator_)
+  {
+    alignment = device->getPhysicalDevice()->getProperties().limits.minStorageBufferOffsetAlignment;
+
+    createDescriptorSetLayout();
+    createPipeline(shaders, cache);
+    frames.resize(framesInFlight);
+  }
+
+  ~InstanceCuller()
+  {
+    for (Frame &frame : frames) {
+      releaseFrame(frame);
+    }
+    (*device)->destroyPipeline(pipeline);
+    (*device)->destroyPipelineLayout(pipelineLayout);
+    (*device)->destroyDescriptorSetLayout(descriptorSetLayout);
+  }
+
+  InstanceCuller(const InstanceCuller &) = delete;
+  InstanceCuller &operator=(const InstanceCuller &) = delete;
+
+  // Records the culling pass of frame: count instances from instances, against one view-projection matrix per
+  // viewport. indexCount and radius describe the mesh every instance draws. Outside of any render pass, only after the
+  // frame's fence has signaled. Leaves everything ready for draw in the graphics pass that follows.
+  void record(vk::CommandBuffer commandBuffer, size_t frameIndex, vk::Buffer instances, uint32_t count,
+              const std::vector<glm::mat4> &viewProjections, uint32_t indexCount, float radius)
+  {
+    Frame &frame = frames[frameIndex];
+    uint32_t viewports = static_cast<uint32_t>(viewProjections.size());
+    reserve(frame, count, viewports);
+
+    (*device)->resetDescriptorPool(frame.pool);
+    std::vector<vk::DescriptorSetLayout> layouts(viewports, descriptorSetLayout);
+    std::vector<vk::DescriptorSet> sets = (*device)->allocateDescriptorSets({ frame.pool, viewports, layouts.data() });
+
+    CullDraw reset = {};
+    reset.command.indexCount = indexCount;
+    for (uint32_t v = 0; v < viewports; v++) {
+      vk::DescriptorBufferInfo buffers[] = {
+        {    instances,                      0, count * sizeof(InstanceData)},
+        {frame.visible, v * frame.visibleStride, count * sizeof(InstanceData)},
+        {  frame.draws,    v * frame.drawStride,             sizeof(CullDraw)},
+      };
+      vk::WriteDescriptorSet writes[3];
+      for (uint32_t b = 0; b < 3; b++) {
+        writes[b].dstSet = sets[v];
+        writes[b].dstBinding = b;
+        writes[b].descriptorCount = 1;
+        writes[b].descriptorType = vk::DescriptorType::eStorageBuffer;
+        writes[b].pBufferInfo = &buffers[b];
+      }
+      (*device)->updateDescriptorSets(3, writes, 0, nullptr);
+
+      commandBuffer.updateBuffer(frame.draws, v * frame.drawStride, sizeof(reset), &reset);
+    }
+
+    vk::MemoryBarrier resetBarrier(
+        vk::AccessFlagBits::eTransferWrite,
+        vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite
+    );
+    commandBuffer.pipelineBarrier(
+        vk::PipelineStageFlagBits::eTransfer,
+        vk::PipelineStageFlagBits::eComputeShader,
+        {},
+        resetBarrier,
+        nullptr,
+        nullptr
+    );
+
+    commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline);
+    for (uint32_t v = 0; v < viewports; v++) {
+      CullConstants constants = {};
+      extractFrustumPlanes(viewProjections[v], constants.planes);
+      constants.count = count;
+      constants.radius = radius;
+
+      commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, pipelineLayout, 0, 1, &sets[v], 0, nullptr);
+      commandBuffer.pushConstants(
+          pipelineLayout,
+          vk::ShaderStageFlagBits::eCompute,
+          0,
+          sizeof(constants),
+          &constants
+      );
+      commandBuffer.dispatch((count + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+    }
+
+    vk::MemoryBarrier cullBarrier(
+        vk::AccessFlagBits::eShaderWrite,
+        vk::AccessFlagBits::eIndirectCommandRead | vk::AccessFlagBits::eVertexAttributeRead
+    );
+    commandBuffer.pipelineBarrier(
+        vk::PipelineStageFlagBits::eComputeShader,
+        vk::PipelineStageFlagBits::eDrawIndirect | vk::PipelineStageFlagBits::eVertexInput,
+        {},
+        cullBarrier,
+        nullptr,
+        nullptr
+    );
+  }
+
+  // Draws what survived culling for viewport, reading the instances from vertex binding 1. The instanced pipeline,
+  // the mesh and its index buffer must be bound. Only reads, so the recording threads may call it at the same time.
+  void draw(vk::CommandBuffer commandBuffer, size_t frameIndex, size_t viewport) const
+  {
+    const Frame &frame = frames[frameIndex];
+
+    vk::DeviceSize visibleOffset = viewport * frame.visibleStride;
+    commandBuffer.bindVertexBuffers(1, 1, &frame.visible, &visibleOffset);
+
+    vk::DeviceSize drawOffset = viewport * frame.drawStride;
+    if (device->cmdDrawIndexedIndirectCount) {
+      device->cmdDrawIndexedIndirectCount(
+          commandBuffer,
+          frame.draws,
+          drawOffset,
+          frame.draws,
+          drawOffset + offsetof(CullDraw, drawCount),
+          1,
+          sizeof(CullDraw)
+      );
+    }
+    else {
+      // Draws zero instances when nothing is visible.
+      commandBuffer.drawIndexedIndirect(frame.draws, drawOffset, 1, sizeof(CullDraw));
+    }
+  }
+
+private:
+  struct Frame {
+    vk::DescriptorPool pool;
+    uint32_t viewports = 0; // Sets the pool and buffers have room for
+    size_t capacity = 0;    // Instances per viewport
+
+    vk::Buffer visible;
+    Allocation visibleMemory;
+    vk::DeviceSize visibleStride = 0; // Between viewports
+
+    vk::Buffer draws;
+    Allocation drawsMemory;
+    vk::DeviceSize drawStride = 0;
+  };
+
+  Device *device;
+  MemoryAllocator *allocator;
+  vk::DeviceSize alignment = 1; // Of storage buffer descriptor offsets
+
+  vk::DescriptorSetLayout descriptorSetLayout;
+  vk::PipelineLayout pipelineLayout;
+  vk::Pipeline pipeline;
+  std::vector<Frame> frames;
+
+  vk::DeviceSize align(vk::DeviceSize size) const { return (size + alignment - 1) / alignment * alignment; }
+
+  // Makes room for count instances in each of viewports. The frame's fence has signaled, so its old buffers can go
+  // right away.
+  void reserve(Frame &frame, size_t count, uint32_t viewports)
+  {
+    if (count <= frame.capacity && viewports <= frame.viewports) {
+      return;
+    }
+    releaseFrame(frame);
+
+    frame.capacity = std::max(count, frame.capacity + frame.capacity / 2);
+    frame.viewports = viewports;
+
+    vk::DescriptorPoolSize poolSize(vk::DescriptorType::eStorageBuffer, 3 * viewports);
+    try {
+      frame.pool = (*device)->createDescriptorPool({ {}, viewports, 1, &poolSize });
+    }
+    catch (vk::SystemError) {
+      throw std::runtime_error("failed to create culling descriptor pool!");
+    }
+
+    frame.visibleStride = align(frame.capacity * sizeof(InstanceData));
+    createBuffer(
+        frame.visibleStride * viewports,
+        vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eVertexBuffer,
+        frame.visible,
+        frame.visibleMemory
+    );
+
+    frame.drawStride = align(sizeof(CullDraw));
+    createBuffer(
+        frame.drawStride * viewports,
+        vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer |
+            vk::BufferUsageFlagBits::eTransferDst,
+        frame.draws,
+        frame.drawsMemory
+    );
+  }
+
+  void releaseFrame(Frame &frame)
+  {
+    if (frame.pool) {
+      (*device)->destroyDescriptorPool(frame.pool);
+      (*device)->destroyBuffer(frame.visible);
+      allocator->free(frame.visibleMemory);
+      (*device)->destroyBuffer(frame.draws);
+      allocator->free(frame.drawsMemory);
+    }
+    frame = Frame();
+  }
+
+  void createBuffer(vk::DeviceSize size, vk::BufferUsageFlags usage, vk::Buffer &buffer, Allocation &memory)
+  {
+    vk::BufferCreateInfo bufferInfo = {};
+    bufferInfo.size = size;
+    bufferInfo.usage = usage;
+    bufferInfo.sharingMode = vk::SharingMode::eExclusive;
+
+    try {
+      buffer = (*device)->createBuffer(bufferInfo);
+    }
+    catch (vk::SystemError) {
+      throw std::runtime_error("failed to create culling buffer!");
+    }
+
+    memory = allocator->allocate(
+        (*device)->getBufferMemoryRequirements(buffer),
+        vk::MemoryPropertyFlagBits::eDeviceLocal
+    );
+    allocator->bindBuffer(buffer, memory);
+  }
+
+  void createDescriptorSetLayout()
+  {
+    vk::DescriptorSetLayoutBinding bindings[3];
+    for (uint32_t b = 0; b < 3; b++) {
+      bindings[b].binding = b;
+      bindings[b].descriptorType = vk::DescriptorType::eStorageBuffer;
+      bindings[b].descriptorCount = 1;
+      bindings[b].stageFlags = vk::ShaderStageFlagBits::eCompute;
+    }
+
+    try {
+      descriptorSetLayout = (*device)->createDescriptorSetLayout({ {}, 3, bindings });
+    }
+    catch (vk::SystemError) {
+      throw std::runtime_error("failed to create culling descriptor set layout!");
+    }
+  }
+
+  void createPipeline(ShaderLibrary *shaders, vk::PipelineCache cache)
+  {
+    vk::PushConstantRange pushConstants(vk::ShaderStageFlagBits::eCompute, 0, sizeof(CullConstants));
+
+    try {
+      pipelineLayout = (*device)->createPipelineLayout({ {}, 1, &descriptorSetLayout, 1, &pushConstants });
+    }
+    catch (vk::SystemError) {
+      throw std::runtime_error("failed to create culling pipeline layout!");
+    }
+
+    vk::ComputePipelineCreateInfo pipelineInfo = {};
+    pipelineInfo.stage = vk::PipelineShaderStageCreateInfo(
+        {},
+        vk::ShaderStageFlagBits::eCompute,
+        shaders->load(CULL_SHADER),
+        "main"
+    );
+    pipelineInfo.layout = pipelineLayout;
+
+    try {
+      pipeline = (*device)->createComputePipeline(cache, pipelineInfo).value;
+    }
+    catch (vk::SystemError) {
+      throw std::runtime_error("failed to create culling pipeline!");
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,48 @@
+#pragma once
+#ifndef DELETION_QUEUE_HH
+#define DELETION_QUEUE_HH
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <utility>
+
+// Deferred destruction of objects that frames still in flight may reference: replaced pipelines, the old swapchain
+// and its framebuffers after a resize, and so on. Each entry is tagged with the number of the frame being built when it
+// was retired; every frame that can reference it has that number or a lower one. It is destroyed once that frame has
+// been submitted and its fence has signaled, so nothing ever waits for the whole device to go idle. Render thread only.
+class DeletionQueue {
+public:
+  void push(uint64_t frame, std::function<void()> destroy) { entries.push_back({ frame, std::move(destroy) }); }
+
+  // Destroys everything tagged with completedFrame or earlier. Frames complete in order, so entries do too.
+  void collect(uint64_t completedFrame)
+  {
+    while (!entries.empty() && entries.front().frame <= completedFrame) {
+      auto destroy = std::move(entries.front().destroy);
+      entries.pop_front();
+      destroy();
+    }
+  }
+
+  // Destroys everything. Only once the device is idle.
+  void flush()
+  {
+    while (!entries.empty()) {
+      auto destroy = std::move(entries.front().destroy);
+      entries.pop_front();
+      destroy();
+    }
+  }
+
+  size_t size() const { return entries.size(); }
+
+private:
+  struct Entry {
+    uint64_t frame;
+    std::function<void()> destroy;
+  };
+  std::deque<Entry> entries;
+};
+
+#endif
@@ -15,6 +15,15 @@ const std::vector<const char *> deviceExtensions = {
   VK_KHR_SWAPCHAIN_EXTENSION_NAME,
 };
 
+// Offscreen rendering never presents, so the swapchain extension is not needed. This keeps software ICDs such as
+// lavapipe usable on machines without a display.
+const std::vector<const char *> headlessDeviceExtensions = {};
+
+// Enabled when the device has them, nothing depends on them. Check with hasExtension.
+const std::vector<const char *> optionalDeviceExtensions = {
+  VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME,
+};
+
 const VkPhysicalDeviceFeatures requiredFeatures {
   .multiViewport = VK_TRUE,
 };
@@ -23,6 +32,7 @@ const VkPhysicalDeviceFeatures requiredFeatures {
 struct QueueFamilyIndices {
   std::optional<uint32_t> graphicsFamily;
   std::optional<uint32_t> presentFamily;
+  std::optional<uint32_t> transferFamily; // Only set for a transfer family without graphics (a DMA queue)
 
   bool isComplete() { return graphicsFamily.has_value() && presentFamily.has_value(); }
 };
@@ -35,7 +45,7 @@ struct SwapchainSupportDetails {
 
 class Device {
 public:
-  Device(vk::Instance instance_) : instance(instance_) {
+  Device(vk::Instance instance_, bool headless_ = false) : instance(instance_), headless(headless_) {
     pickPhysicalDevice();
     createLogicalDevice();
     createCommandPool();
@@ -52,15 +62,31 @@ public:
 
   vk::Device* operator->() { return &device; }
 
+  bool isHeadless() const { return headless; }
+
+  vk::PhysicalDevice *getPhysicalDevice() { return &physicalDevice; }
+
+  bool hasExtension(const std::string &name) const { return enabledExtensions.count(name) > 0; }
+
   vk::Queue graphicsQueue;
   vk::Queue presentQueue;
+  vk::Queue transferQueue; // Same as graphicsQueue when there is no dedicated transfer family
   vk::CommandPool commandPool;
 
+  // Null without VK_KHR_draw_indirect_count. Loaded by hand, the loader library doesn't export extension commands.
+  PFN_vkCmdDrawIndexedIndirectCountKHR cmdDrawIndexedIndirectCount = nullptr;
+
 private:
   vk::PhysicalDevice physicalDevice;
   vk::Device device;
   vk::Instance instance;
+  bool headless = false;
+  std::set<std::string> enabledExtensions;
 
+  const std::vector<const char *> &requiredExtensions() const
+  {
+    return headless ? headlessDeviceExtensions : deviceExtensions;
+  }
 
   void pickPhysicalDevice()
   {
@@ -87,6 +113,9 @@ private:
 
     std::vector<vk::DeviceQueueCreateInfo> queueCreateInfos;
     std::set<uint32_t> uniqueQueueFamilies = { indices.graphicsFamily.value(), indices.presentFamily.value() };
+    if (indices.transferFamily.has_value()) {
+      uniqueQueueFamilies.insert(indices.transferFamily.value());
+    }
 
     float queuePriority = 1.0f;
 
@@ -104,8 +133,21 @@ private:
         queueCreateInfos.data()
     );
     createInfo.pEnabledFeatures = &deviceFeatures;
-    createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
-    createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+
+    std::vector<const char *> extensions = requiredExtensions();
+    std::set<std::string> available;
+    for (const auto &extension : physicalDevice.enumerateDeviceExtensionProperties()) {
+      available.insert(extension.extensionName);
+    }
+    for (const char *extension : optionalDeviceExtensions) {
+      if (available.count(extension)) {
+        extensions.push_back(extension);
+      }
+    }
+    enabledExtensions.insert(extensions.begin(), extensions.end());
+
+    createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
+    createInfo.ppEnabledExtensionNames = extensions.data();
 
     if (vdb::enableValidationLayers) {
       createInfo.enabledLayerCount = static_cast<uint32_t>(vdb::validationLayers.size());
@@ -121,6 +163,14 @@ private:
 
     graphicsQueue = device.getQueue(indices.graphicsFamily.value(), 0);
     presentQueue = device.getQueue(indices.presentFamily.value(), 0);
+    transferQueue = indices.transferFamily.has_value() ? device.getQueue(indices.transferFamily.value(), 0)
+                                                       : graphicsQueue;
+
+    if (hasExtension(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME)) {
+      cmdDrawIndexedIndirectCount = reinterpret_cast<PFN_vkCmdDrawIndexedIndirectCountKHR>(
+          device.getProcAddr("vkCmdDrawIndexedIndirectCountKHR")
+      );
+    }
   }
 
   void createCommandPool()
@@ -156,13 +206,13 @@ private:
 
   bool checkDeviceExtensionSupport(const vk::PhysicalDevice &device)
   {
-    std::set<std::string> requiredExtensions(deviceExtensions.begin(), deviceExtensions.end());
+    std::set<std::string> missingExtensions(requiredExtensions().begin(), requiredExtensions().end());
 
     for (const auto &extension : device.enumerateDeviceExtensionProperties()) {
-      requiredExtensions.erase(extension.extensionName);
+      missingExtensions.erase(extension.extensionName);
     }
 
-    return requiredExtensions.empty();
+    return missingExtensions.empty();
   }
 
   bool checkDeviceFeatureSupport(const vk::PhysicalDevice &device)
@@ -202,7 +252,13 @@ public:
         indices.graphicsFamily = i;
       }
 
-      if (queueFamily.queueCount > 0 && physicalDevice.getWin32PresentationSupportKHR(i)) {
+      if (headless) {
+        // Nothing is presented, so the graphics queue doubles as the "present" queue.
+        if (indices.graphicsFamily.has_value()) {
+          indices.presentFamily = indices.graphicsFamily;
+        }
+      }
+      else if (queueFamily.queueCount > 0 && physicalDevice.getWin32PresentationSupportKHR(i)) {
         indices.presentFamily = i;
       }
 
@@ -211,6 +267,19 @@ public:
       }
       i++;
     }
+
+    // Prefer a transfer-only family, the dedicated copy engine on discrete GPUs. Fall back to any transfer capable
+    // family without graphics.
+    for (uint32_t j = 0; j < queueFamilies.size(); j++) {
+      const auto &flags = queueFamilies[j].queueFlags;
+      if (queueFamilies[j].queueCount == 0 || !(flags & vk::QueueFlagBits::eTransfer) ||
+          (flags & vk::QueueFlagBits::eGraphics)) {
+        continue;
+      }
+      if (!indices.transferFamily.has_value() || !(flags & vk::QueueFlagBits::eCompute)) {
+        indices.transferFamily = j;
+      }
+    }
     return indices;
   }
 
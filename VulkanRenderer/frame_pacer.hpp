@@ -0,0 +1,150 @@
+#pragma once
+#ifndef FRAME_PACER_HH
+#define FRAME_PACER_HH
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <thread>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+#endif
+
+// Starts frames at a fixed period without burning a core. Most of the wait is spent asleep in short slices; only the
+// last stretch, about as long as a slice tends to overshoot, is spun. The overshoot is measured as we go, so the spin
+// stays short on systems with a precise timer and grows where sleeps are coarse. Render thread only.
+class FramePacer {
+  using clock = std::chrono::steady_clock;
+
+public:
+  FramePacer()
+  {
+#ifdef _WIN32
+    // High resolution timers (Windows 10 1803 and later) wake up within a fraction of a millisecond. Older systems
+    // get a normal timer and simply spin a bit longer.
+    timer = CreateWaitableTimerExW(nullptr, nullptr, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+    if (!timer) {
+      timer = CreateWaitableTimerExW(nullptr, nullptr, 0, TIMER_ALL_ACCESS);
+    }
+#endif
+  }
+
+  ~FramePacer()
+  {
+#ifdef _WIN32
+    if (timer) {
+      CloseHandle(timer);
+    }
+#endif
+  }
+
+  FramePacer(const FramePacer &) = delete;
+  FramePacer &operator=(const FramePacer &) = delete;
+
+  // Blocks until the next frame is due, period seconds after the previous one, and returns how late it woke up in
+  // seconds. A period of 0 doesn't wait at all. A frame that is already more than a whole period late starts right
+  // away and restarts the cadence from there, instead of rushing out frames to catch up.
+  double wait(double period)
+  {
+    clock::time_point now = clock::now();
+    if (period <= 0) {
+      hasDeadline = false;
+      return 0;
+    }
+
+    auto step = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(period));
+    if (!hasDeadline || now - deadline > 2 * step) {
+      deadline = now;
+      hasDeadline = true;
+      return 0;
+    }
+
+    deadline += step;
+    sleepUntil(deadline);
+    return std::max(std::chrono::duration<double>(clock::now() - deadline).count(), 0.0);
+  }
+
+private:
+  clock::time_point deadline;
+  bool hasDeadline = false;
+
+  // Running mean and variance (Welford) of how long a one millisecond sleep really takes, in seconds. Starts out
+  // pessimistic so the first frames spin rather than oversleep.
+  double sleepMean = 0.005;
+  double sleepM2 = 0;
+  uint64_t sleepCount = 1;
+
+#ifdef _WIN32
+  HANDLE timer = nullptr;
+#endif
+
+  void sleepUntil(clock::time_point target)
+  {
+    for (;;) {
+      clock::time_point start = clock::now();
+      double remaining = std::chrono::duration<double>(target - start).count();
+      if (remaining <= sleepMean + std::sqrt(sleepM2 / sleepCount)) {
+        break;
+      }
+
+      sleepSlice();
+
+      double observed = std::chrono::duration<double>(clock::now() - start).count();
+      sleepCount++;
+      double delta = observed - sleepMean;
+      sleepMean += delta / sleepCount;
+      sleepM2 += delta * (observed - sleepMean);
+    }
+
+    while (clock::now() < target) {
+      std::this_thread::yield();
+    }
+  }
+
+  void sleepSlice()
+  {
+#ifdef _WIN32
+    if (timer) {
+      LARGE_INTEGER due;
+      due.QuadPart = -10000; // 1 ms, relative, in 100 ns units
+      if (SetWaitableTimerEx(timer, &due, 0, nullptr, nullptr, nullptr, 0)) {
+        WaitForSingleObject(timer, INFINITE);
+        return;
+      }
+    }
+#endif
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+};
+
+#ifdef _WIN32
+// Refresh rate of the monitor that shows most of hwnd (the primary monitor for nullptr), in Hz. 0 if unknown.
+inline double displayRefreshRate(HWND hwnd)
+{
+  HMONITOR monitor = MonitorFromWindow(hwnd, MONITOR_DEFAULTTOPRIMARY);
+  MONITORINFOEXW monitorInfo = {};
+  monitorInfo.cbSize = sizeof(monitorInfo);
+  if (!GetMonitorInfoW(monitor, &monitorInfo)) {
+    return 0;
+  }
+
+  DEVMODEW mode = {};
+  mode.dmSize = sizeof(mode);
+  if (!EnumDisplaySettingsW(monitorInfo.szDevice, ENUM_CURRENT_SETTINGS, &mode)) {
+    return 0;
+  }
+
+  // 0 and 1 mean "hardware default".
+  return mode.dmDisplayFrequency > 1 ? static_cast<double>(mode.dmDisplayFrequency) : 0;
+}
+#endif
+
+#endif
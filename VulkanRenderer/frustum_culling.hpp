@@ -0,0 +1,288 @@
+#pragma once
+#ifndef FRUSTUM_CULLING_HH
+#define FRUSTUM_CULLING_HH
+
+#include <glm/glm.hpp>
+
+#include <bit>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "simd.hpp"
+
+// Spheres tested per iteration of the SIMD loops. Bounds are padded to a multiple of this.
+const size_t CULL_BATCH = 8;
+
+// The six planes of the frustum of viewProjection (Gribb/Hartmann), normals pointing inwards and normalized, so a
+// point's signed distance to a plane is in world units. Near is taken from OpenGL style clip space (-w..w), which for
+// zero-to-one depth is merely a bit generous.
+inline void extractFrustumPlanes(const glm::mat4 &viewProjection, glm::vec4 planes[6])
+{
+  glm::vec4 rows[4];
+  for (int i = 0; i < 4; i++) {
+    rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+  }
+  planes[0] = rows[3] + rows[0]; // Left
+  planes[1] = rows[3] - rows[0]; // Right
+  planes[2] = rows[3] + rows[1]; // Bottom
+  planes[3] = rows[3] - rows[1]; // Top
+  planes[4] = rows[3] + rows[2]; // Near
+  planes[5] = rows[3] - rows[2]; // Far
+  for (int i = 0; i < 6; i++) {
+    planes[i] /= glm::length(glm::vec3(planes[i]));
+  }
+}
+
+// Frustum planes split into one array per coefficient, ready to be broadcast.
+struct Frustum {
+  float a[6], b[6], c[6], d[6];
+
+  Frustum() = default;
+
+  explicit Frustum(const glm::mat4 &viewProjection)
+  {
+    glm::vec4 planes[6];
+    extractFrustumPlanes(viewProjection, planes);
+    for (int p = 0; p < 6; p++) {
+      a[p] = planes[p].x;
+      b[p] = planes[p].y;
+      c[p] = planes[p].z;
+      d[p] = planes[p].w;
+    }
+  }
+};
+
+// Bounding spheres in structure-of-arrays layout, one array per component, so the SIMD paths load CULL_BATCH
+// spheres with four plain loads. The padding at the end has a radius of minus infinity and never passes.
+class BoundsStore {
+public:
+  void resize(size_t count)
+  {
+    size_t padded = (count + CULL_BATCH - 1) / CULL_BATCH * CULL_BATCH;
+    x.resize(padded);
+    y.resize(padded);
+    z.resize(padded);
+    r.resize(padded);
+    for (size_t i = count; i < padded; i++) {
+      x[i] = y[i] = z[i] = 0.0f;
+      r[i] = -std::numeric_limits<float>::infinity();
+    }
+    count_ = count;
+  }
+
+  void set(size_t i, const glm::vec3 &center, float radius)
+  {
+    x[i] = center.x;
+    y[i] = center.y;
+    z[i] = center.z;
+    r[i] = radius;
+  }
+
+  size_t size() const { return count_; }
+  size_t paddedSize() const { return r.size(); }
+
+  const float *getX() const { return x.data(); }
+  const float *getY() const { return y.data(); }
+  const float *getZ() const { return z.data(); }
+  const float *getRadius() const { return r.data(); }
+
+private:
+  std::vector<float> x, y, z, r;
+  size_t count_ = 0;
+};
+
+enum class CullPath { Scalar, Sse, Avx2, Neon };
+
+namespace cull {
+
+// Writes base plus the index of every set bit of mask to out, lowest first. Returns the new length of out.
+inline size_t emit(uint32_t mask, uint32_t base, uint32_t *out, size_t n)
+{
+  while (mask) {
+    out[n++] = base + static_cast<uint32_t>(std::countr_zero(mask));
+    mask &= mask - 1;
+  }
+  return n;
+}
+
+// One sphere at a time. The reference the SIMD paths have to match, and the fallback everywhere else. Writes every
+// index and only advances past the visible ones, so there is no branch on the result.
+inline size_t scalar(const BoundsStore &bounds, const Frustum &f, uint32_t *out)
+{
+  const float *x = bounds.getX(), *y = bounds.getY(), *z = bounds.getZ(), *r = bounds.getRadius();
+  size_t n = 0;
+  for (size_t i = 0; i < bounds.size(); i++) {
+    bool inside = true;
+    for (int p = 0; p < 6; p++) {
+      inside &= f.a[p] * x[i] + f.b[p] * y[i] + f.c[p] * z[i] + f.d[p] >= -r[i];
+    }
+    out[n] = static_cast<uint32_t>(i);
+    n += inside;
+  }
+  return n;
+}
+
+#ifdef SIMD_X86
+// Two 4-wide halves per batch. SSE2 is part of x86-64, so this needs no check.
+inline size_t sse(const BoundsStore &bounds, const Frustum &f, uint32_t *out)
+{
+  const float *x = bounds.getX(), *y = bounds.getY(), *z = bounds.getZ(), *r = bounds.getRadius();
+  size_t n = 0;
+  for (size_t i = 0; i < bounds.paddedSize(); i += CULL_BATCH) {
+    uint32_t mask = 0;
+    for (size_t h = 0; h < CULL_BATCH; h += 4) {
+      __m128 vx = _mm_loadu_ps(x + i + h);
+      __m128 vy = _mm_loadu_ps(y + i + h);
+      __m128 vz = _mm_loadu_ps(z + i + h);
+      __m128 negR = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(r + i + h));
+
+      __m128 inside = _mm_cmpeq_ps(vx, vx); // All ones, unless x is NaN
+      for (int p = 0; p < 6; p++) {
+        __m128 dist = _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(_mm_set1_ps(f.a[p]), vx), _mm_mul_ps(_mm_set1_ps(f.b[p]), vy)),
+            _mm_add_ps(_mm_mul_ps(_mm_set1_ps(f.c[p]), vz), _mm_set1_ps(f.d[p]))
+        );
+        inside = _mm_and_ps(inside, _mm_cmpge_ps(dist, negR));
+      }
+      mask |= static_cast<uint32_t>(_mm_movemask_ps(inside)) << h;
+    }
+    n = emit(mask, static_cast<uint32_t>(i), out, n);
+  }
+  return n;
+}
+
+SIMD_TARGET_AVX2 inline size_t avx2(const BoundsStore &bounds, const Frustum &f, uint32_t *out)
+{
+  const float *x = bounds.getX(), *y = bounds.getY(), *z = bounds.getZ(), *r = bounds.getRadius();
+  size_t n = 0;
+  for (size_t i = 0; i < bounds.paddedSize(); i += CULL_BATCH) {
+    __m256 vx = _mm256_loadu_ps(x + i);
+    __m256 vy = _mm256_loadu_ps(y + i);
+    __m256 vz = _mm256_loadu_ps(z + i);
+    __m256 negR = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(r + i));
+
+    __m256 inside = _mm256_cmp_ps(vx, vx, _CMP_EQ_OQ);
+    for (int p = 0; p < 6; p++) {
+      __m256 dist = _mm256_fmadd_ps(_mm256_set1_ps(f.c[p]), vz, _mm256_set1_ps(f.d[p]));
+      dist = _mm256_fmadd_ps(_mm256_set1_ps(f.b[p]), vy, dist);
+      dist = _mm256_fmadd_ps(_mm256_set1_ps(f.a[p]), vx, dist);
+      inside = _mm256_and_ps(inside, _mm256_cmp_ps(dist, negR, _CMP_GE_OQ));
+    }
+    n = emit(static_cast<uint32_t>(_mm256_movemask_ps(inside)), static_cast<uint32_t>(i), out, n);
+  }
+  return n;
+}
+
+#endif
+
+#ifdef SIMD_NEON
+// Two 4-wide halves per batch, like the SSE path. NEON is part of AArch64.
+inline size_t neon(const BoundsStore &bounds, const Frustum &f, uint32_t *out)
+{
+  const float *x = bounds.getX(), *y = bounds.getY(), *z = bounds.getZ(), *r = bounds.getRadius();
+  const uint32_t laneBits[4] = { 1, 2, 4, 8 };
+  uint32x4_t bits = vld1q_u32(laneBits);
+
+  size_t n = 0;
+  for (size_t i = 0; i < bounds.paddedSize(); i += CULL_BATCH) {
+    uint32_t mask = 0;
+    for (size_t h = 0; h < CULL_BATCH; h += 4) {
+      float32x4_t vx = vld1q_f32(x + i + h);
+      float32x4_t vy = vld1q_f32(y + i + h);
+      float32x4_t vz = vld1q_f32(z + i + h);
+      float32x4_t negR = vnegq_f32(vld1q_f32(r + i + h));
+
+      uint32x4_t inside = vceqq_f32(vx, vx);
+      for (int p = 0; p < 6; p++) {
+        float32x4_t dist = vdupq_n_f32(f.d[p]);
+        dist = vfmaq_n_f32(dist, vx, f.a[p]);
+        dist = vfmaq_n_f32(dist, vy, f.b[p]);
+        dist = vfmaq_n_f32(dist, vz, f.c[p]);
+        inside = vandq_u32(inside, vcgeq_f32(dist, negR));
+      }
+      mask |= vaddvq_u32(vandq_u32(inside, bits)) << h;
+    }
+    n = emit(mask, static_cast<uint32_t>(i), out, n);
+  }
+  return n;
+}
+#endif
+
+} // namespace cull
+
+inline bool cullPathSupported(CullPath path)
+{
+  switch (path) {
+  case CullPath::Scalar:
+    return true;
+#ifdef SIMD_X86
+  case CullPath::Sse:
+    return true;
+  case CullPath::Avx2:
+    return cpuHasAvx2();
+#endif
+#ifdef SIMD_NEON
+  case CullPath::Neon:
+    return true;
+#endif
+  default:
+    return false;
+  }
+}
+
+// The widest path this CPU runs.
+inline CullPath bestCullPath()
+{
+  for (CullPath path : { CullPath::Avx2, CullPath::Neon, CullPath::Sse }) {
+    if (cullPathSupported(path)) {
+      return path;
+    }
+  }
+  return CullPath::Scalar;
+}
+
+inline const char *cullPathName(CullPath path)
+{
+  switch (path) {
+  case CullPath::Sse:
+    return "sse";
+  case CullPath::Avx2:
+    return "avx2";
+  case CullPath::Neon:
+    return "neon";
+  default:
+    return "scalar";
+  }
+}
+
+// Replaces visible with the indices of the spheres in bounds that are inside or touching frustum, in ascending order,
+// for the draw recorder to walk instead of the whole list. An unsupported path falls back to scalar.
+inline void cullSpheres(const BoundsStore &bounds, const Frustum &frustum, std::vector<uint32_t> &visible,
+                        CullPath path = bestCullPath())
+{
+  // Every path writes at most one index per sphere.
+  visible.resize(bounds.size());
+  size_t count = 0;
+  switch (cullPathSupported(path) ? path : CullPath::Scalar) {
+#ifdef SIMD_X86
+  case CullPath::Sse:
+    count = cull::sse(bounds, frustum, visible.data());
+    break;
+  case CullPath::Avx2:
+    count = cull::avx2(bounds, frustum, visible.data());
+    break;
+#endif
+#ifdef SIMD_NEON
+  case CullPath::Neon:
+    count = cull::neon(bounds, frustum, visible.data());
+    break;
+#endif
+  default:
+    count = cull::scalar(bounds, frustum, visible.data());
+    break;
+  }
+  visible.resize(count);
+}
+
+#endif
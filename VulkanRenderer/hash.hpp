@@ -0,0 +1,19 @@
+#pragma once
+#ifndef HASH_HH
+#define HASH_HH
+
+#include <cstddef>
+#include <cstdint>
+
+// 64-bit FNV-1a. Fast enough for content hashing of files and cache blobs, not meant to resist deliberate collisions.
+inline uint64_t fnv1a(const void *data, size_t size, uint64_t h = 0xcbf29ce484222325ull)
+{
+  const uint8_t *bytes = static_cast<const uint8_t *>(data);
+  for (size_t i = 0; i < size; i++) {
+    h ^= bytes[i];
+    h *= 0x100000001b3ull;
+  }
+  return h;
+}
+
+#endif
@@ -0,0 +1,215 @@
+#pragma once
+#ifndef INSTANCES_HH
+#define INSTANCES_HH
+
+#include <glm/glm.hpp>
+#include <vulkan/vulkan.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <vector>
+
+#include "allocator.hpp"
+#include "device.hpp"
+#include "upload.hpp"
+
+// Per-instance attributes of the instanced draw path, packed to 28 bytes. Locations match the instance inputs of
+// texture_shader.vert and instanced.vert.
+struct InstanceData {
+  glm::vec3 position;
+  glm::vec3 rotation; // Euler angles in radians, applied around x, then y, then z
+  float scale;
+
+  static vk::VertexInputBindingDescription getBindingDescription()
+  {
+    vk::VertexInputBindingDescription bindingDescription {};
+    bindingDescription.binding = 1;
+    bindingDescription.stride = sizeof(InstanceData);
+    bindingDescription.inputRate = vk::VertexInputRate::eInstance;
+
+    return bindingDescription;
+  }
+
+  static std::array<vk::VertexInputAttributeDescription, 3> getAttributeDescriptions()
+  {
+    std::array<vk::VertexInputAttributeDescription, 3> attributeDescriptions {};
+    attributeDescriptions[0].binding = 1;
+    attributeDescriptions[0].location = 3;
+    attributeDescriptions[0].format = vk::Format::eR32G32B32Sfloat;
+    attributeDescriptions[0].offset = offsetof(InstanceData, position);
+
+    attributeDescriptions[1].binding = 1;
+    attributeDescriptions[1].location = 4;
+    attributeDescriptions[1].format = vk::Format::eR32G32B32Sfloat;
+    attributeDescriptions[1].offset = offsetof(InstanceData, rotation);
+
+    attributeDescriptions[2].binding = 1;
+    attributeDescriptions[2].location = 5;
+    attributeDescriptions[2].format = vk::Format::eR32Sfloat;
+    attributeDescriptions[2].offset = offsetof(InstanceData, scale);
+
+    return attributeDescriptions;
+  }
+};
+static_assert(sizeof(InstanceData) == 28, "InstanceData must stay tightly packed");
+
+// Instances per dirty-tracking chunk. 1024 instances are 28 KB, small enough that scattered edits don't upload much
+// that didn't change and large enough that a full rewrite is only a few hundred copies.
+const size_t INSTANCE_CHUNK_SIZE = 1024;
+
+// The instance list and its copies on the GPU. There is one device-local storage buffer per frame in flight, read by
+// the culling pass (culling.hpp), so a frame never reads instances the transfer queue is writing for the next one.
+// Every copy tracks which chunks changed since its frame last used it and only those are uploaded when the frame comes
+// around again.
+//
+// Lives as long as the renderer, so the instance list survives a re-attach. Render thread only.
+class InstanceBuffer {
+public:
+  InstanceBuffer(Device *device_, MemoryAllocator *allocator_) : device(device_), allocator(allocator_) {}
+
+  ~InstanceBuffer() { release(); }
+
+  InstanceBuffer(const InstanceBuffer &) = delete;
+  InstanceBuffer &operator=(const InstanceBuffer &) = delete;
+
+  // Destroys the GPU copies and prepares framesInFlight new ones, which are filled with the whole list on their first
+  // flush. Only while the device is idle.
+  void reset(uint32_t framesInFlight)
+  {
+    release();
+    slots.resize(framesInFlight);
+  }
+
+  // Destroys the GPU copies. Only while the device is idle.
+  void release()
+  {
+    for (Slot &slot : slots) {
+      if (slot.buffer) {
+        (*device)->destroyBuffer(slot.buffer);
+        allocator->free(slot.memory);
+      }
+    }
+    slots.clear();
+  }
+
+  void assign(std::vector<InstanceData> data)
+  {
+    instances = std::move(data);
+    markDirty(0, instances.size());
+  }
+
+  // Overwrites count instances starting at first. Whatever lies past the end of the list is dropped.
+  void update(size_t first, const InstanceData *data, size_t count)
+  {
+    if (first >= instances.size()) {
+      return;
+    }
+    count = std::min(count, instances.size() - first);
+    std::copy(data, data + count, instances.begin() + first);
+    markDirty(first, count);
+  }
+
+  // Queues uploads of everything frame's copy is missing. Only after frame's fence has signaled, before the frame's
+  // uploads are flushed. Grows the copy first if the list outgrew it.
+  void flush(size_t frame, UploadService &uploads)
+  {
+    Slot &slot = slots[frame];
+    if (instances.empty()) {
+      return;
+    }
+
+    if (slot.capacity < instances.size()) {
+      if (slot.buffer) {
+        (*device)->destroyBuffer(slot.buffer);
+        allocator->free(slot.memory);
+      }
+      // Some headroom, so a list that grows a little at a time doesn't reallocate every frame.
+      slot.capacity = std::max(instances.size(), slot.capacity + slot.capacity / 2);
+      createBuffer(slot);
+      std::fill(slot.dirty.begin(), slot.dirty.end(), true);
+    }
+    slot.dirty.resize(chunkCount(), true);
+
+    // Contiguous runs of dirty chunks go up as one copy each.
+    size_t chunk = 0;
+    while (chunk < slot.dirty.size()) {
+      if (!slot.dirty[chunk]) {
+        chunk++;
+        continue;
+      }
+
+      size_t end = chunk;
+      while (end < slot.dirty.size() && slot.dirty[end]) {
+        slot.dirty[end] = false;
+        end++;
+      }
+
+      size_t first = chunk * INSTANCE_CHUNK_SIZE;
+      size_t count = std::min(end * INSTANCE_CHUNK_SIZE, instances.size()) - first;
+      uploads.upload(
+          slot.buffer,
+          first * sizeof(InstanceData),
+          instances.data() + first,
+          count * sizeof(InstanceData),
+          vk::PipelineStageFlagBits::eComputeShader,
+          vk::AccessFlagBits::eShaderRead
+      );
+      chunk = end;
+    }
+  }
+
+  vk::Buffer getBuffer(size_t frame) const { return slots[frame].buffer; }
+  uint32_t size() const { return static_cast<uint32_t>(instances.size()); }
+
+private:
+  struct Slot {
+    vk::Buffer buffer;
+    Allocation memory;
+    size_t capacity = 0;     // In instances
+    std::vector<bool> dirty; // One flag per chunk
+  };
+
+  Device *device;
+  MemoryAllocator *allocator;
+  std::vector<InstanceData> instances;
+  std::vector<Slot> slots;
+
+  size_t chunkCount() const { return (instances.size() + INSTANCE_CHUNK_SIZE - 1) / INSTANCE_CHUNK_SIZE; }
+
+  void markDirty(size_t first, size_t count)
+  {
+    if (count == 0) {
+      return;
+    }
+    size_t begin = first / INSTANCE_CHUNK_SIZE;
+    size_t end = (first + count + INSTANCE_CHUNK_SIZE - 1) / INSTANCE_CHUNK_SIZE;
+    for (Slot &slot : slots) {
+      slot.dirty.resize(std::max(slot.dirty.size(), end), true);
+      std::fill(slot.dirty.begin() + begin, slot.dirty.begin() + end, true);
+    }
+  }
+
+  void createBuffer(Slot &slot)
+  {
+    vk::BufferCreateInfo bufferInfo = {};
+    bufferInfo.size = slot.capacity * sizeof(InstanceData);
+    bufferInfo.usage = vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eStorageBuffer;
+    bufferInfo.sharingMode = vk::SharingMode::eExclusive;
+
+    try {
+      slot.buffer = (*device)->createBuffer(bufferInfo);
+    }
+    catch (vk::SystemError) {
+      throw std::runtime_error("failed to create instance buffer!");
+    }
+
+    slot.memory = allocator->allocate(
+        (*device)->getBufferMemoryRequirements(slot.buffer),
+        vk::MemoryPropertyFlagBits::eDeviceLocal
+    );
+    allocator->bindBuffer(slot.buffer, slot.memory);
+  }
+};
+
+#endif
@@ -2,18 +2,37 @@
 #ifndef INTEROP_H
 #define INTEROP_H
 
-#define FRAME_DELTA_COUNT 100
+// Timings for a single frame, in seconds. gpuFrame lags the other values by the number of frames in flight since it
+// is only read back once the GPU is done with a frame. Read by the frontend with readPerfSamples, so the layout must
+// match the C# side.
+struct sFrameSample {
+  double cpuFrame = 0;        // Wall clock time between consecutive frames
+  double submitToPresent = 0; // From queue submit until presentKHR returns
+  double gpuFrame = 0;        // Timestamp delta around the render pass, 0 if timestamps are unsupported
+  double cpuRecord = 0;       // CPU work between the frame becoming available and queue submit
+  double acquireWait = 0;     // Blocked in waitForFences and acquireNextImageKHR
+  double paceJitter = 0;      // How late the frame pacer woke up for this frame, 0 when frames aren't paced
+};
+
+// How the render thread spaces out frames, set with setFramePacing.
+enum ePacingMode {
+  PACING_UNCAPPED = 0, // As fast as acquire and present allow
+  PACING_FIXED = 1,    // A fixed number of frames per second
+  PACING_DISPLAY = 2,  // The refresh rate of the monitor showing the first viewport
+};
 
-struct sPerf {
-  double frameDelta[FRAME_DELTA_COUNT];
-  int currentIndex = 0;
-  // double frameDelta = 0;
+// Camera of one viewport, set with setViewportCamera. Same layout as on the C# side.
+struct sCamera {
+  float eye[3];
+  float target[3];
+  float up[3];
+  float fovYDegrees;
+  float nearPlane;
+  float farPlane;
 };
 
 typedef void (__stdcall *BufferCallback)(const char *buf, int len);
 typedef void (__stdcall *DebugCallback)(const char * msg);
-typedef void (__stdcall *PerformanceMonitorCallback)(sPerf data);
-// typedef void (__stdcall *PerformanceMonitorCallback)(double frameDelta);
 typedef void (__stdcall *SimpleCallback)();
 
 #endif
@@ -0,0 +1,338 @@
+#pragma once
+#ifndef JOBS_HH
+#define JOBS_HH
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class JobSystem;
+
+// Counts unfinished jobs. Jobs started with a counter increment it and decrement it once they are done; a job can
+// also depend on a counter and is held back until it reaches zero. Also keeps the first exception one of its jobs
+// threw, for wait to rethrow. Must outlive the jobs it counts.
+class JobCounter {
+public:
+  JobCounter() = default;
+
+  // The job that brought the counter to zero may still be releasing continuations; wait for it to let go.
+  ~JobCounter() { std::lock_guard<std::mutex> lock(mutex); }
+
+  JobCounter(const JobCounter &) = delete;
+  JobCounter &operator=(const JobCounter &) = delete;
+
+  bool isDone() const { return value.load(std::memory_order_acquire) == 0; }
+
+private:
+  friend class JobSystem;
+
+  struct Continuation {
+    std::function<void()> fn;
+    JobCounter *counter;
+    const char *name;
+  };
+
+  std::atomic<uint32_t> value { 0 };
+  std::mutex mutex; // Guards continuations against the counter reaching zero, and error
+  std::vector<Continuation> continuations;
+  std::exception_ptr error;
+};
+
+// One finished job, for the trace hook. worker is the index of the pool thread that ran it, or getWorkerCount() for a
+// thread outside the pool that helped while waiting.
+struct JobTraceEvent {
+  const char *name;
+  uint32_t worker;
+  std::chrono::steady_clock::time_point start;
+  std::chrono::steady_clock::time_point end;
+};
+
+using JobTraceHook = std::function<void(const JobTraceEvent &)>;
+
+// A work-stealing thread pool. Every worker has its own deque: it pushes and pops its own jobs at the back, so nested
+// work stays hot in its cache, and idle workers steal from the front of the others. Threads outside the pool (the
+// render thread, the UI) submit to a shared queue and help out with whatever is queued while they wait, so waiting on
+// a counter never idles a core and nested waits can't deadlock.
+//
+// Workers spin briefly when they run dry and then sleep until something is queued. An exception thrown by a job is
+// kept on its counter and rethrown by wait; a job without a counter has nowhere to report it and must not throw.
+class JobSystem {
+public:
+  // One worker per core, minus the thread that submits most of the work.
+  static uint32_t defaultWorkerCount() { return std::max(std::thread::hardware_concurrency(), 2u) - 1; }
+
+  // With no workers at all, every job runs on whichever thread waits for it.
+  explicit JobSystem(uint32_t workerCount = defaultWorkerCount())
+  {
+    // One queue per worker plus one shared by every other thread.
+    for (uint32_t i = 0; i <= workerCount; i++) {
+      queues.push_back(std::make_unique<Queue>());
+    }
+    for (uint32_t i = 0; i < workerCount; i++) {
+      workers.emplace_back([this, i]() { workerLoop(i); });
+    }
+  }
+
+  ~JobSystem()
+  {
+    {
+      std::lock_guard<std::mutex> lock(sleepMutex);
+      stopping = true;
+    }
+    sleepCondition.notify_all();
+    for (auto &worker : workers) {
+      worker.join();
+    }
+  }
+
+  JobSystem(const JobSystem &) = delete;
+  JobSystem &operator=(const JobSystem &) = delete;
+
+  uint32_t getWorkerCount() const { return static_cast<uint32_t>(workers.size()); }
+
+  // Called after every job with its name, thread and timing, from the thread that ran it, so it has to be thread
+  // safe. Only while no jobs are running.
+  void setTraceHook(JobTraceHook hook) { traceHook = std::move(hook); }
+
+  // Queues fn. counter, if given, counts it until it has finished. dependency, if given, holds it back until that
+  // counter reaches zero. name shows up in traces and has to outlive the job.
+  void run(std::function<void()> fn, JobCounter *counter = nullptr, JobCounter *dependency = nullptr,
+           const char *name = "job")
+  {
+    if (counter) {
+      counter->value.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    if (dependency) {
+      std::lock_guard<std::mutex> lock(dependency->mutex);
+      if (!dependency->isDone()) {
+        dependency->continuations.push_back({ std::move(fn), counter, name });
+        return;
+      }
+    }
+    push({ std::move(fn), counter, name });
+  }
+
+  // Runs queued jobs on the calling thread until counter reaches zero, then rethrows the first exception any of the
+  // jobs it counted threw, once.
+  void wait(JobCounter &counter)
+  {
+    uint32_t self = currentQueue();
+    while (!counter.isDone()) {
+      if (!runOne(self)) {
+        std::this_thread::yield();
+      }
+    }
+
+    std::exception_ptr error;
+    {
+      std::lock_guard<std::mutex> lock(counter.mutex);
+      error.swap(counter.error);
+    }
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+
+  // Calls body(begin, end) for consecutive ranges of at most grain items covering [0, count), spread over the pool,
+  // and returns once all of them have finished. The calling thread takes the first range itself. The first exception a
+  // range throws is rethrown here.
+  template <typename Body>
+  void parallelFor(size_t count, size_t grain, Body &&body, const char *name = "parallelFor")
+  {
+    if (count == 0) {
+      return;
+    }
+    grain = std::max<size_t>(grain, 1);
+    size_t ranges = (count + grain - 1) / grain;
+
+    JobCounter counter;
+    std::mutex errorMutex;
+    std::exception_ptr error;
+    auto runRange = [&](size_t range) {
+      try {
+        body(range * grain, std::min(count, (range + 1) * grain));
+      }
+      catch (...) {
+        std::lock_guard<std::mutex> lock(errorMutex);
+        if (!error) {
+          error = std::current_exception();
+        }
+      }
+    };
+
+    for (size_t range = 1; range < ranges; range++) {
+      run([&runRange, range]() { runRange(range); }, &counter, nullptr, name);
+    }
+    execute({ [&runRange]() { runRange(0); }, nullptr, name }, currentQueue());
+    wait(counter);
+
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+
+private:
+  struct Job {
+    std::function<void()> fn;
+    JobCounter *counter;
+    const char *name;
+  };
+
+  struct Queue {
+    std::mutex mutex;
+    std::deque<Job> jobs;
+  };
+
+  std::vector<std::unique_ptr<Queue>> queues;
+  std::vector<std::thread> workers;
+  JobTraceHook traceHook;
+
+  std::atomic<uint32_t> queued { 0 }; // Jobs in any queue, for sleeping workers
+  std::mutex sleepMutex;
+  std::condition_variable sleepCondition;
+  bool stopping = false;
+
+  // Which pool, if any, the current thread works for, and its queue there.
+  static inline thread_local JobSystem *currentPool = nullptr;
+  static inline thread_local uint32_t currentIndex = 0;
+
+  uint32_t currentQueue() const { return currentPool == this ? currentIndex : getWorkerCount(); }
+
+  void push(Job job)
+  {
+    {
+      // Counted before it is published, so a thread that takes it can never bring queued below zero. Under the lock,
+      // so a worker can't check queued and go to sleep in between.
+      std::lock_guard<std::mutex> lock(sleepMutex);
+      queued.fetch_add(1, std::memory_order_release);
+    }
+    Queue &queue = *queues[currentQueue()];
+    {
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      queue.jobs.push_back(std::move(job));
+    }
+    sleepCondition.notify_one();
+  }
+
+  // Takes a job from the back of the thread's own queue or, failing that, the front of any other, and runs it.
+  bool runOne(uint32_t self)
+  {
+    Job job;
+    bool found = false;
+    {
+      Queue &own = *queues[self];
+      std::lock_guard<std::mutex> lock(own.mutex);
+      if (!own.jobs.empty()) {
+        job = std::move(own.jobs.back());
+        own.jobs.pop_back();
+        found = true;
+      }
+    }
+
+    for (size_t i = 1; !found && i < queues.size(); i++) {
+      Queue &victim = *queues[(self + i) % queues.size()];
+      std::lock_guard<std::mutex> lock(victim.mutex);
+      if (!victim.jobs.empty()) {
+        job = std::move(victim.jobs.front());
+        victim.jobs.pop_front();
+        found = true;
+      }
+    }
+
+    if (!found) {
+      return false;
+    }
+    queued.fetch_sub(1, std::memory_order_relaxed);
+    execute(std::move(job), self);
+    return true;
+  }
+
+  void execute(Job job, uint32_t self)
+  {
+    std::chrono::steady_clock::time_point start;
+    if (traceHook) {
+      start = std::chrono::steady_clock::now();
+    }
+
+    try {
+      job.fn();
+    }
+    catch (...) {
+      if (!job.counter) {
+        std::terminate();
+      }
+      std::lock_guard<std::mutex> lock(job.counter->mutex);
+      if (!job.counter->error) {
+        job.counter->error = std::current_exception();
+      }
+    }
+
+    if (traceHook) {
+      traceHook({ job.name, self, start, std::chrono::steady_clock::now() });
+    }
+    if (job.counter) {
+      finish(*job.counter);
+    }
+  }
+
+  // Releases whatever waited for counter once its last job is done. Only the last one takes the lock.
+  void finish(JobCounter &counter)
+  {
+    uint32_t value = counter.value.load(std::memory_order_relaxed);
+    while (value > 1) {
+      if (counter.value.compare_exchange_weak(value, value - 1, std::memory_order_acq_rel)) {
+        return;
+      }
+    }
+
+    std::vector<JobCounter::Continuation> continuations;
+    {
+      std::lock_guard<std::mutex> lock(counter.mutex);
+      if (counter.value.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+        return;
+      }
+      continuations.swap(counter.continuations);
+    }
+    for (auto &continuation : continuations) {
+      push({ std::move(continuation.fn), continuation.counter, continuation.name });
+    }
+  }
+
+  void workerLoop(uint32_t index)
+  {
+    currentPool = this;
+    currentIndex = index;
+
+    uint32_t idleSpins = 0;
+    while (true) {
+      if (runOne(index)) {
+        idleSpins = 0;
+        continue;
+      }
+
+      // Work tends to come in bursts, one per frame, so spin a little before paying for a wake-up.
+      if (++idleSpins < 64) {
+        std::this_thread::yield();
+        continue;
+      }
+      idleSpins = 0;
+
+      std::unique_lock<std::mutex> lock(sleepMutex);
+      sleepCondition.wait(lock, [this]() { return stopping || queued.load(std::memory_order_acquire) > 0; });
+      if (stopping) {
+        return;
+      }
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,148 @@
+#pragma once
+#ifndef MAPPED_FILE_HH
+#define MAPPED_FILE_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Read-only memory mapping of a whole file. The data is page aligned, so it can be handed to APIs that want aligned
+// pointers (SPIR-V words, for example) without a copy. Move only.
+class MappedFile {
+public:
+  MappedFile() = default;
+
+  explicit MappedFile(const std::string &path)
+  {
+#ifdef _WIN32
+    file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+      throw std::runtime_error("failed to open file " + path + "!");
+    }
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize)) {
+      close();
+      throw std::runtime_error("failed to get size of " + path + "!");
+    }
+    length = static_cast<size_t>(fileSize.QuadPart);
+    if (length == 0) {
+      return;
+    }
+
+    mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping) {
+      close();
+      throw std::runtime_error("failed to map " + path + "!");
+    }
+    bytes = static_cast<const uint8_t *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+#else
+    fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw std::runtime_error("failed to open file " + path + "!");
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+      close();
+      throw std::runtime_error("failed to get size of " + path + "!");
+    }
+    length = static_cast<size_t>(info.st_size);
+    if (length == 0) {
+      return;
+    }
+
+    void *view = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    bytes = view == MAP_FAILED ? nullptr : static_cast<const uint8_t *>(view);
+#endif
+    if (!bytes) {
+      close();
+      throw std::runtime_error("failed to map " + path + "!");
+    }
+  }
+
+  ~MappedFile() { close(); }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  MappedFile(MappedFile &&other) noexcept { *this = std::move(other); }
+
+  MappedFile &operator=(MappedFile &&other) noexcept
+  {
+    if (this != &other) {
+      close();
+#ifdef _WIN32
+      file = other.file;
+      mapping = other.mapping;
+      other.file = INVALID_HANDLE_VALUE;
+      other.mapping = nullptr;
+#else
+      fd = other.fd;
+      other.fd = -1;
+#endif
+      bytes = other.bytes;
+      length = other.length;
+      other.bytes = nullptr;
+      other.length = 0;
+    }
+    return *this;
+  }
+
+  const uint8_t *data() const { return bytes; }
+  size_t size() const { return length; }
+
+private:
+  const uint8_t *bytes = nullptr;
+  size_t length = 0;
+
+#ifdef _WIN32
+  HANDLE file = INVALID_HANDLE_VALUE;
+  HANDLE mapping = nullptr;
+#else
+  int fd = -1;
+#endif
+
+  void close()
+  {
+#ifdef _WIN32
+    if (bytes) {
+      UnmapViewOfFile(bytes);
+    }
+    if (mapping) {
+      CloseHandle(mapping);
+    }
+    if (file != INVALID_HANDLE_VALUE) {
+      CloseHandle(file);
+    }
+    file = INVALID_HANDLE_VALUE;
+    mapping = nullptr;
+#else
+    if (bytes) {
+      munmap(const_cast<uint8_t *>(bytes), length);
+    }
+    if (fd >= 0) {
+      ::close(fd);
+    }
+    fd = -1;
+#endif
+    bytes = nullptr;
+    length = 0;
+  }
+};
+
+#endif
@@ -0,0 +1,143 @@
+#pragma once
+#ifndef MESH_FILE_HH
+#define MESH_FILE_HH
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include "mapped_file.hpp"
+
+// A .vkmesh is a MeshFileHeader followed by the vertex stream and then the index stream, both exactly as the vertex
+// input and index buffer bindings read them. Each stream starts on a MESH_STREAM_ALIGNMENT boundary, which covers
+// every alignment Vulkan asks of buffer copies, so loading is a memory mapping and one copy per stream with nothing
+// to parse. Little endian, like every platform the renderer runs on.
+const uint32_t MESH_FILE_MAGIC = 0x48534D56; // "VMSH"
+const uint32_t MESH_FILE_VERSION = 1;
+const uint64_t MESH_STREAM_ALIGNMENT = 256;
+
+struct MeshFileHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t vertexStride; // Bytes per vertex
+  uint32_t vertexCount;
+  uint32_t indexSize;    // 2 or 4 bytes per index
+  uint32_t indexCount;
+  uint64_t vertexOffset; // From the start of the file
+  uint64_t indexOffset;
+  float radius;          // Bounding sphere around the origin, so loading doesn't have to look at a single vertex
+  uint32_t reserved;
+};
+static_assert(sizeof(MeshFileHeader) == 48, "MeshFileHeader is a file format and must not change size");
+
+inline uint64_t alignMeshStream(uint64_t offset)
+{
+  return (offset + MESH_STREAM_ALIGNMENT - 1) / MESH_STREAM_ALIGNMENT * MESH_STREAM_ALIGNMENT;
+}
+
+// A .vkmesh mapped into memory. The stream pointers point straight into the mapping, so they can be copied into a
+// staging buffer or mapped device memory as they are. Checks the header and that both streams lie inside the file;
+// whether the indices stay inside the vertex stream is left to indicesInRange, as it means reading all of them. Move
+// only.
+class MeshFile {
+public:
+  MeshFile() = default;
+
+  explicit MeshFile(const std::string &path) : file(path)
+  {
+    if (file.size() < sizeof(MeshFileHeader)) {
+      throw std::runtime_error("invalid mesh file " + path + "!");
+    }
+    header = *reinterpret_cast<const MeshFileHeader *>(file.data());
+
+    if (header.magic != MESH_FILE_MAGIC || header.version != MESH_FILE_VERSION || header.vertexStride == 0 ||
+        (header.indexSize != 2 && header.indexSize != 4) || !fits(header.vertexOffset, getVertexBytes()) ||
+        !fits(header.indexOffset, getIndexBytes())) {
+      throw std::runtime_error("invalid mesh file " + path + "!");
+    }
+  }
+
+  const void *getVertexData() const { return file.data() + header.vertexOffset; }
+  size_t getVertexBytes() const { return static_cast<size_t>(header.vertexStride) * header.vertexCount; }
+  uint32_t getVertexStride() const { return header.vertexStride; }
+  uint32_t getVertexCount() const { return header.vertexCount; }
+
+  const void *getIndexData() const { return file.data() + header.indexOffset; }
+  size_t getIndexBytes() const { return static_cast<size_t>(header.indexSize) * header.indexCount; }
+  uint32_t getIndexSize() const { return header.indexSize; }
+  uint32_t getIndexCount() const { return header.indexCount; }
+
+  // Reads the whole index stream once; true if every index refers to a vertex in the file.
+  bool indicesInRange() const
+  {
+    if (header.indexSize == 2) {
+      return maxIndex(static_cast<const uint16_t *>(getIndexData())) < header.vertexCount;
+    }
+    return maxIndex(static_cast<const uint32_t *>(getIndexData())) < header.vertexCount;
+  }
+
+  float getRadius() const { return header.radius; }
+  size_t getFileSize() const { return file.size(); }
+
+private:
+  MappedFile file;
+  MeshFileHeader header = {};
+
+  bool fits(uint64_t offset, size_t bytes) const
+  {
+    return offset % MESH_STREAM_ALIGNMENT == 0 && offset <= file.size() && bytes <= file.size() - offset;
+  }
+
+  // The stream is aligned for any index type, see fits. Zero for an empty stream.
+  template <typename Index>
+  uint64_t maxIndex(const Index *indices) const
+  {
+    Index max = 0;
+    for (uint32_t i = 0; i < header.indexCount; i++) {
+      max = std::max(max, indices[i]);
+    }
+    return max;
+  }
+};
+
+// Writes a .vkmesh. vertices holds vertexCount vertices of vertexStride bytes each, indices indexCount indices of
+// indexSize (2 or 4) bytes each. For the converter and tests; the renderer only reads.
+inline void writeMeshFile(const std::string &path, const void *vertices, uint32_t vertexStride, uint32_t vertexCount,
+                          const void *indices, uint32_t indexSize, uint32_t indexCount, float radius)
+{
+  MeshFileHeader header = {};
+  header.magic = MESH_FILE_MAGIC;
+  header.version = MESH_FILE_VERSION;
+  header.vertexStride = vertexStride;
+  header.vertexCount = vertexCount;
+  header.indexSize = indexSize;
+  header.indexCount = indexCount;
+  header.vertexOffset = alignMeshStream(sizeof(MeshFileHeader));
+  header.indexOffset = alignMeshStream(header.vertexOffset + static_cast<uint64_t>(vertexStride) * vertexCount);
+  header.radius = radius;
+
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  if (!out) {
+    throw std::runtime_error("failed to open file " + path + "!");
+  }
+
+  const char padding[MESH_STREAM_ALIGNMENT] = {};
+  auto pad = [&](uint64_t offset) {
+    out.write(padding, static_cast<std::streamsize>(offset - static_cast<uint64_t>(out.tellp())));
+  };
+
+  out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  pad(header.vertexOffset);
+  out.write(static_cast<const char *>(vertices), static_cast<std::streamsize>(vertexStride) * vertexCount);
+  pad(header.indexOffset);
+  out.write(static_cast<const char *>(indices), static_cast<std::streamsize>(indexSize) * indexCount);
+  if (!out) {
+    throw std::runtime_error("failed to write " + path + "!");
+  }
+}
+
+#endif
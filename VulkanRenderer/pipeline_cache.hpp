@@ -0,0 +1,174 @@
+#pragma once
+#ifndef PIPELINE_CACHE_HH
+#define PIPELINE_CACHE_HH
+
+#include <vulkan/vulkan.hpp>
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "debugging.hpp"
+#include "device.hpp"
+#include "hash.hpp"
+
+// Default location of the on-disk pipeline cache, relative to the working directory.
+const char *const PIPELINE_CACHE_FILE = "pipeline_cache.bin";
+
+// Prepended to the driver's cache blob. The driver validates its own header too, but only vendor, device and cache
+// UUID; a driver update that keeps the UUID would happily accept stale data. The hash catches truncated writes.
+struct PipelineCacheFileHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t vendorID;
+  uint32_t deviceID;
+  uint32_t driverVersion;
+  uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+  uint64_t dataSize;
+  uint64_t dataHash;
+};
+
+// A vk::PipelineCache that is loaded from disk when the engine starts and written back when it shuts down. Every
+// pipeline the renderer builds goes through it, so after the first run attach no longer compiles anything from
+// scratch. A file written for another GPU or driver is ignored and the cache starts out empty.
+class PipelineCache {
+public:
+  PipelineCache(Device *device_, std::string path_) : device(device_), path(std::move(path_))
+  {
+    properties = device->getPhysicalDevice()->getProperties();
+
+    std::vector<char> data = load();
+
+    vk::PipelineCacheCreateInfo cacheInfo = {};
+    cacheInfo.initialDataSize = data.size();
+    cacheInfo.pInitialData = data.empty() ? nullptr : data.data();
+
+    try {
+      cache = (*device)->createPipelineCache(cacheInfo);
+    }
+    catch (vk::SystemError) {
+      if (data.empty()) {
+        throw std::runtime_error("failed to create pipeline cache!");
+      }
+      // The driver rejected data that passed our checks. Start over rather than fail to start.
+      vdb::debugOutput("Pipeline cache data rejected by the driver, starting with an empty cache.");
+      cache = (*device)->createPipelineCache({});
+    }
+  }
+
+  ~PipelineCache()
+  {
+    try {
+      save();
+    }
+    catch (std::exception &e) {
+      vdb::debugOutput(e.what());
+    }
+    (*device)->destroyPipelineCache(cache);
+  }
+
+  operator vk::PipelineCache() const { return cache; }
+
+  // Writes to a temporary file next to the cache and renames it over the old one, so a crash halfway through never
+  // leaves a truncated cache behind.
+  void save()
+  {
+    if (path.empty()) {
+      return;
+    }
+
+    std::vector<uint8_t> data = (*device)->getPipelineCacheData(cache);
+
+    PipelineCacheFileHeader header = makeHeader();
+    header.dataSize = data.size();
+    header.dataHash = fnv1a(data.data(), data.size());
+
+    std::string tempPath = path + ".tmp";
+    {
+      std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+      if (!file.is_open()) {
+        throw std::runtime_error("failed to write pipeline cache!");
+      }
+      file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+      file.write(reinterpret_cast<const char *>(data.data()), data.size());
+      if (!file) {
+        throw std::runtime_error("failed to write pipeline cache!");
+      }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(tempPath, path, error);
+    if (error) {
+      std::filesystem::remove(tempPath, error);
+      throw std::runtime_error("failed to replace pipeline cache file!");
+    }
+  }
+
+private:
+  static const uint32_t MAGIC = 0x43505641; // "AVPC"
+  static const uint32_t VERSION = 1;
+
+  Device *device;
+  std::string path;
+  vk::PhysicalDeviceProperties properties;
+  vk::PipelineCache cache;
+
+  PipelineCacheFileHeader makeHeader() const
+  {
+    PipelineCacheFileHeader header = {};
+    header.magic = MAGIC;
+    header.version = VERSION;
+    header.vendorID = properties.vendorID;
+    header.deviceID = properties.deviceID;
+    header.driverVersion = properties.driverVersion;
+    memcpy(header.pipelineCacheUUID, properties.pipelineCacheUUID.data(), VK_UUID_SIZE);
+    return header;
+  }
+
+  // Returns the driver blob, or nothing if there is no usable cache file.
+  std::vector<char> load()
+  {
+    if (path.empty()) {
+      return {};
+    }
+
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+      vdb::debugOutput("No pipeline cache found, starting cold.");
+      return {};
+    }
+
+    PipelineCacheFileHeader header = {};
+    file.read(reinterpret_cast<char *>(&header), sizeof(header));
+
+    PipelineCacheFileHeader expected = makeHeader();
+    if (!file || header.magic != expected.magic || header.version != expected.version ||
+        header.vendorID != expected.vendorID || header.deviceID != expected.deviceID ||
+        header.driverVersion != expected.driverVersion ||
+        memcmp(header.pipelineCacheUUID, expected.pipelineCacheUUID, VK_UUID_SIZE) != 0) {
+      vdb::debugOutput("Pipeline cache was written for another device or driver, ignoring it.");
+      return {};
+    }
+
+    // The size comes from disk, so it has to match the file before anything is allocated for it.
+    std::error_code error;
+    uintmax_t fileSize = std::filesystem::file_size(path, error);
+    if (error || fileSize < sizeof(header) || header.dataSize != fileSize - sizeof(header)) {
+      vdb::debugOutput("Pipeline cache file is corrupt, ignoring it.");
+      return {};
+    }
+
+    std::vector<char> data(static_cast<size_t>(header.dataSize));
+    file.read(data.data(), data.size());
+    if (!file || fnv1a(data.data(), data.size()) != header.dataHash) {
+      vdb::debugOutput("Pipeline cache file is corrupt, ignoring it.");
+      return {};
+    }
+
+    return data;
+  }
+};
+
+#endif
@@ -0,0 +1,124 @@
+#pragma once
+#ifndef RECORDING_HH
+#define RECORDING_HH
+
+#include <vulkan/vulkan.hpp>
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+#include "device.hpp"
+#include "jobs.hpp"
+
+// Records a draw list in parallel into secondary command buffers. The list is split into threadCount contiguous
+// chunks, recorded as jobs on the job system; the calling thread records the first chunk itself and helps with the
+// rest. The primary command buffer executes the returned buffers, in order, inside its render pass.
+//
+// Every chunk has its own transient command pool per frame in flight and only one job ever records a chunk, so nothing
+// is shared between threads while recording and a pool is only reset once the fence of its frame has signaled. A frame
+// can record several render passes (one per viewport); each pass gets its own set of secondary command buffers out of
+// the same pools.
+class ParallelRecorder {
+public:
+  // Records draws [begin, end) into the given secondary command buffer. Pipeline, vertex and index buffer bindings are
+  // not inherited by secondary command buffers, so the callback has to bind them itself.
+  using RecordChunk = std::function<void(vk::CommandBuffer, size_t, size_t)>;
+
+  ParallelRecorder(Device *device_, JobSystem *jobs_, uint32_t framesInFlight, uint32_t threadCount_)
+      : device(device_), jobs(jobs_), threadCount(std::max(threadCount_, 1u))
+  {
+    uint32_t graphicsFamily = device->findQueueFamilies().graphicsFamily.value();
+
+    pools.resize(framesInFlight);
+    commandBuffers.resize(framesInFlight);
+    try {
+      for (size_t frame = 0; frame < framesInFlight; frame++) {
+        for (uint32_t t = 0; t < threadCount; t++) {
+          pools[frame].push_back(
+              (*device)->createCommandPool({ vk::CommandPoolCreateFlagBits::eTransient, graphicsFamily })
+          );
+        }
+      }
+    }
+    catch (vk::SystemError) {
+      throw std::runtime_error("failed to create recording command pools!");
+    }
+  }
+
+  ~ParallelRecorder()
+  {
+    for (auto &framePools : pools) {
+      for (auto pool : framePools) {
+        (*device)->destroyCommandPool(pool);
+      }
+    }
+  }
+
+  uint32_t getThreadCount() const { return threadCount; }
+
+  // Blocks until every chunk is recorded. Passes of a frame are recorded in order starting at 0, which resets the
+  // frame's pools. The returned buffers stay valid until pass 0 of frame is recorded again.
+  const std::vector<vk::CommandBuffer> &record(size_t frame, size_t pass,
+                                               const vk::CommandBufferInheritanceInfo &inheritance, size_t drawCount,
+                                               const RecordChunk &recordChunk)
+  {
+    if (pass == 0) {
+      for (auto pool : pools[frame]) {
+        (*device)->resetCommandPool(pool);
+      }
+    }
+    // Allocated once and kept, resetting a pool doesn't free its command buffers.
+    while (commandBuffers[frame].size() <= pass) {
+      std::vector<vk::CommandBuffer> passBuffers;
+      try {
+        for (auto pool : pools[frame]) {
+          passBuffers.push_back((*device)->allocateCommandBuffers({ pool, vk::CommandBufferLevel::eSecondary, 1 })[0]);
+        }
+      }
+      catch (vk::SystemError) {
+        throw std::runtime_error("failed to allocate secondary command buffers!");
+      }
+      commandBuffers[frame].push_back(std::move(passBuffers));
+    }
+
+    jobs->parallelFor(
+        threadCount,
+        1,
+        [&](size_t chunk, size_t) { recordChunkOf(chunk, frame, pass, inheritance, drawCount, recordChunk); },
+        "record"
+    );
+    return commandBuffers[frame][pass];
+  }
+
+private:
+  Device *device;
+  JobSystem *jobs;
+  uint32_t threadCount;
+
+  std::vector<std::vector<vk::CommandPool>> pools;                         // [frame][chunk]
+  std::vector<std::vector<std::vector<vk::CommandBuffer>>> commandBuffers; // [frame][pass][chunk]
+
+  void recordChunkOf(size_t chunk, size_t frame, size_t pass, const vk::CommandBufferInheritanceInfo &inheritance,
+                     size_t drawCount, const RecordChunk &recordChunk)
+  {
+    size_t chunkSize = (drawCount + threadCount - 1) / threadCount;
+    size_t begin = std::min(drawCount, chunk * chunkSize);
+    size_t end = std::min(drawCount, begin + chunkSize);
+
+    vk::CommandBuffer commandBuffer = commandBuffers[frame][pass][chunk];
+
+    vk::CommandBufferBeginInfo beginInfo = {};
+    beginInfo.flags = vk::CommandBufferUsageFlagBits::eRenderPassContinue |
+                      vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+    beginInfo.pInheritanceInfo = &inheritance;
+
+    commandBuffer.begin(beginInfo);
+    if (begin < end) {
+      recordChunk(commandBuffer, begin, end);
+    }
+    commandBuffer.end();
+  }
+};
+
+#endif
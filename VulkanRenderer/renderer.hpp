@@ -11,22 +11,46 @@
 
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <chrono>
+#include <cmath>
+#include <condition_variable>
 #include <cstdlib>
 #include <cstring>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <mutex>
+#include <numeric>
 #include <optional>
 #include <set>
 #include <stdexcept>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
 #include "interop.h"
+#include "telemetry.hpp"
 #include "timing.hpp"
 
+#include "allocator.hpp"
+#include "culling.hpp"
 #include "debugging.hpp"
+#include "deletion_queue.hpp"
 #include "device.hpp"
+#include "frame_pacer.hpp"
+#include "frustum_culling.hpp"
+#include "instances.hpp"
+#include "jobs.hpp"
+#include "mesh_file.hpp"
+#include "pipeline_cache.hpp"
+#include "recording.hpp"
+#include "shader_library.hpp"
+#include "shader_watcher.hpp"
+#include "swapchain.hpp"
+#include "transforms.hpp"
+#include "uniforms.hpp"
+#include "upload.hpp"
 // #include "fps.hh"
 
 const int MAX_FRAMES_IN_FLIGHT = 2;
@@ -34,7 +58,7 @@ const int MAX_FRAMES_IN_FLIGHT = 2;
 struct SurfaceInfo {
   int width;
   int height;
-  bool isResized = false;
+  uint32_t framesInFlight = MAX_FRAMES_IN_FLIGHT;
   HWND hwnd;
   HINSTANCE hinstance;
 
@@ -82,22 +106,70 @@ const std::vector<Vertex> vertices = {
 
 const std::vector<uint16_t> indices = { 0, 1, 2, 2, 3, 0 };
 
+// Shaders of the graphics pipeline, in stage order (vertex, fragment). Relative to the working directory.
+const std::vector<WatchedShader> pipelineShaders = {
+  {"shaders/source/shader.vert", "shaders/vert.spv"},
+  {"shaders/source/shader.frag", "shaders/frag.spv"},
+};
+
+// Shaders of the instanced pipeline. The fragment shader is shared with the graphics pipeline.
+const std::vector<WatchedShader> instancedShaders = {
+  {"shaders/source/instanced.vert", "shaders/instanced_vert.spv"},
+  {"shaders/source/shader.frag", "shaders/frag.spv"},
+};
+
 struct UniformBufferObject {
   alignas(16) glm::mat4 model;
   alignas(16) glm::mat4 view;
   alignas(16) glm::mat4 proj;
 };
 
+// One indexed draw of the scene mesh. Command buffers are recorded from the list of these every frame.
+struct DrawItem {
+  glm::mat4 model;
+};
+
+// Where a viewport looks at the scene from. The defaults are the view every viewport started out with.
+struct Camera {
+  glm::vec3 eye = glm::vec3(2.0f, 2.0f, 2.0f);
+  glm::vec3 target = glm::vec3(0.0f, 0.0f, 0.0f);
+  glm::vec3 up = glm::vec3(0.0f, 0.0f, 1.0f);
+  float fovY = glm::radians(30.0f);
+  float nearPlane = 0.1f;
+  float farPlane = 10.0f;
+};
+
+// One window (headless: one offscreen target) the scene is rendered into. Each viewport has its own swapchain and
+// camera; the device, pipelines and scene buffers are shared. Only touched by the thread that renders frames.
+struct Viewport {
+  HWND hwnd = nullptr;
+  vk::SurfaceKHR surface; // Null when headless
+  Swapchain *swapchain = nullptr;
+  Camera camera;
+  int width = 0; // Latest size posted for the window, in physical pixels
+  int height = 0;
+  bool isResized = false;
+  std::vector<vk::Semaphore> imageAvailableSemaphores; // One per frame in flight
+  uint32_t imageIndex = 0;                             // Image acquired for the frame being recorded
+};
+
 class Renderer {
 public:
-  Renderer(DebugCallback debugCallback)
+  // A headless renderer never creates a surface or swapchain. It renders into a ring of offscreen images instead,
+  // which lets it run on machines without a display (CI, render farm nodes, software ICDs such as lavapipe).
+  //
+  // The pipeline cache is loaded from pipelineCachePath here and saved back on destruction. An empty path disables it.
+  Renderer(DebugCallback debugCallback, bool headless = false, std::string pipelineCachePath = PIPELINE_CACHE_FILE)
+      : m_headless(headless), m_pipelineCachePath(std::move(pipelineCachePath))
   {
     vdb::externalDebugCallback = debugCallback;
     vdb::debugOutput("External debug callback installed!");
     init();
   }
 
-  Renderer() {
+  Renderer(bool headless = false, std::string pipelineCachePath = PIPELINE_CACHE_FILE)
+      : m_headless(headless), m_pipelineCachePath(std::move(pipelineCachePath))
+  {
     init();
   }
 
@@ -108,15 +180,38 @@ public:
   void init() {
     createInstance();
     vdb::setupDebugCallback(instance);
-    m_device = new Device(instance);
+    m_device = new Device(instance, m_headless);
     device = &static_cast<vk::Device&>(*m_device);
+    m_allocator = new MemoryAllocator(m_device);
+    m_pipelineCache = new PipelineCache(m_device, m_pipelineCachePath);
+    m_shaders = new ShaderLibrary(m_device);
+    m_instances = new InstanceBuffer(m_device, m_allocator);
+    m_jobs = new JobSystem();
   }
 
-  void attach(SurfaceInfo &surfaceInfo)
+  // The first attach sets the renderer up for the given surface and starts the render thread. Every further attach adds
+  // a viewport for another window, drawn by the same thread into the same submit and present.
+  //
+  // startThread = false leaves the renderer attached but idle, so frames can be driven from the calling thread with
+  // runFrames. The benchmark uses this to get deterministic frame counts.
+  void attach(SurfaceInfo &surfaceInfo, bool startThread = true)
   {
     try {
-      m_surfaceInfo = surfaceInfo;
-      initVulkan();
+      std::unique_lock<std::mutex> lock = lockFrames();
+      if (m_attached) {
+        addViewport(surfaceInfo);
+        requestRedraw();
+        vdb::debugOutput("Viewport added!");
+        return;
+      }
+
+      m_framesInFlight = std::max(surfaceInfo.framesInFlight, 1u);
+      initVulkan(surfaceInfo);
+      m_attached = true;
+      if (!startThread) {
+        vdb::debugOutput("Vulkan Renderer attached without a render thread!");
+        return;
+      }
       isRunning = true;
       m_thread = std::thread([this]() {
         try {
@@ -134,173 +229,525 @@ public:
     }
   }
 
+  // Removes the viewport of hwnd (nullptr for the offscreen target of a headless renderer). Removing the last one
+  // detaches the renderer completely.
+  void detach(HWND hwnd)
+  {
+    {
+      std::unique_lock<std::mutex> lock = lockFrames();
+      auto viewport =
+          std::find_if(m_viewports.begin(), m_viewports.end(), [&](Viewport *v) { return v->hwnd == hwnd; });
+      if (viewport == m_viewports.end()) {
+        return;
+      }
+
+      if (m_viewports.size() > 1) {
+        // The window goes away as soon as this returns, so its surface can't wait for the deletion queue. Rare, so
+        // simply waiting for the GPU is fine.
+        device->waitIdle();
+        m_retired.flush();
+        destroyViewport(*viewport);
+        m_viewports.erase(viewport);
+        vdb::debugOutput("Viewport removed!");
+        return;
+      }
+    }
+    detach();
+  }
+
+  // Stops the render thread and destroys every viewport.
   void detach()
   {
     isRunning = false;
-    m_thread.join();
-    cleanupSwapchain();
+    requestRedraw(); // Wakes the render thread if it is idle
+    if (m_thread.joinable()) {
+      m_thread.join();
+    }
+    delete m_shaderWatcher;
+    m_shaderWatcher = nullptr;
+    cleanupViewports();
+    m_attached = false;
     vdb::debugOutput("Vulkan Renderer detached!");
   }
 
-  void setMonitorCallback(PerformanceMonitorCallback callback)
+  // Must only be called from one thread at a time (the UI poll). Safe to call while the render thread is running.
+  size_t readPerfSamples(sFrameSample *buffer, size_t max) { return m_telemetry.pop(buffer, max); }
+
+  void setSimpleCallback(SimpleCallback callback) { simpleCallback = callback; }
+
+  bool isHeadless() const { return m_headless; }
+
+  // attach only logs its errors, so callers that can't carry on without a renderer check this afterwards.
+  bool isAttached() const { return m_attached; }
+
+  AllocatorStats getMemoryStats() { return m_allocator->getStats(); }
+
+  // The worker pool the renderer records and culls on. Engine code can fan out its own work on it (asset decoding,
+  // transform updates, upload preparation) instead of starting threads of its own.
+  JobSystem *getJobSystem() { return m_jobs; }
+
+  // Replaces the scene's draw list. Safe to call from any thread; the render thread picks it up at the start of its
+  // next frame. The built-in spinning quad stops animating once a draw list has been set.
+  void setDrawItems(std::vector<DrawItem> items)
+  {
+    {
+      std::lock_guard<std::mutex> lock(sceneMutex);
+      pendingDrawItems = std::move(items);
+      hasPendingDrawItems = true;
+    }
+    requestRedraw();
+  }
+
+  // Replaces the instance list, drawn with one instanced draw per viewport after the draw list. Safe to call from any
+  // thread; like setDrawItems, the render thread picks it up at the start of its next frame and only uploads what
+  // changed.
+  void setInstances(std::vector<InstanceData> instances)
   {
-    performanceMonitorCallback = callback; // TODO mutex this so it's not called while its being set.
+    {
+      std::lock_guard<std::mutex> lock(sceneMutex);
+      pendingInstances = std::move(instances);
+      hasPendingInstances = true;
+      pendingInstanceEdits.clear(); // Superseded
+    }
+    requestRedraw();
   }
 
-  void setSimpleCallback(SimpleCallback callback) { simpleCallback = callback; }
+  // Replaces the scene mesh, the built-in quad until then, with the .vkmesh at path (see mesh_file.hpp). Its vertices
+  // have to be laid out like Vertex. The file is mapped and checked on the calling thread, which throws if it can't be
+  // used. That includes one pass over the indices, so an index past the last vertex never reaches a draw. The render
+  // thread copies both streams straight out of the mapping into staging memory at the start of its next frame.
+  void loadMesh(const std::string &path)
+  {
+    MeshFile *mesh = new MeshFile(path);
+    if (mesh->getVertexStride() != sizeof(Vertex) || mesh->getVertexCount() == 0 || mesh->getIndexCount() == 0) {
+      delete mesh;
+      throw std::runtime_error("mesh file " + path + " is empty or has the wrong vertex layout!");
+    }
+    if (!mesh->indicesInRange()) {
+      delete mesh;
+      throw std::runtime_error("mesh file " + path + " has indices past its last vertex!");
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(sceneMutex);
+      delete pendingMesh;
+      pendingMesh = mesh;
+    }
+    requestRedraw();
+  }
+
+  // Edits the transform hierarchy that places the draw list. While it has nodes it owns the draw list: draw i is node
+  // i, drawn with its world matrix, and whatever setDrawItems sets is overwritten. edit runs under the scene lock, so
+  // it should be quick. Safe to call from any thread; the render thread recomputes only the subtrees that changed, at
+  // the start of its next frame.
+  void editTransforms(const std::function<void(TransformHierarchy &)> &edit)
+  {
+    {
+      std::lock_guard<std::mutex> lock(sceneMutex);
+      edit(m_transforms);
+    }
+    requestRedraw();
+  }
+
+  // Overwrites instances [first, first + instances.size()) of the list. Only the chunks touched are uploaded again, so
+  // moving a handful of props in a huge scene stays cheap. Safe to call from any thread.
+  void updateInstances(size_t first, std::vector<InstanceData> instances)
+  {
+    {
+      std::lock_guard<std::mutex> lock(sceneMutex);
+      pendingInstanceEdits.push_back({ first, std::move(instances) });
+    }
+    requestRedraw();
+  }
+
+  // Posts a new size for the viewport of hwnd, in logical pixels. Safe to call from any thread and as often as the UI
+  // likes: the render thread only applies the latest size at the start of its next frame, so a window drag costs at
+  // most one swapchain recreation per frame.
+  void resize(HWND hwnd, int width, int height, double dpiScale)
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_updateMutex);
+      ViewportUpdate &update = m_pendingUpdates[hwnd];
+      update.hasSize = true;
+      update.width = std::max(static_cast<int>(std::lround(width * dpiScale)), 0);
+      update.height = std::max(static_cast<int>(std::lround(height * dpiScale)), 0);
+    }
+    requestRedraw();
+  }
+
+  // Sets the camera of hwnd's viewport. Like resize, it takes effect at the start of the next frame.
+  void setCamera(HWND hwnd, const Camera &camera)
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_updateMutex);
+      ViewportUpdate &update = m_pendingUpdates[hwnd];
+      update.hasCamera = true;
+      update.camera = camera;
+    }
+    requestRedraw();
+  }
+
+  // Marks the viewports as out of date. In on-demand mode the render thread sleeps until this is called, so anything
+  // that changes what is on screen without going through the renderer (UI input, animation timers) must call it.
+  // Scene edits, cameras, resizes and shader reloads already do. Safe to call from any thread.
+  void requestRedraw()
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_redrawMutex);
+      m_redrawRequested = true;
+    }
+    m_redrawCondition.notify_one();
+  }
+
+  // In on-demand mode the render thread only draws after requestRedraw, instead of continuously. keepAliveRate, if
+  // above 0, is the minimum number of frames per second it draws anyway. Safe to call from any thread.
+  void setOnDemand(bool enabled, double keepAliveRate)
+  {
+    m_keepAliveRate = keepAliveRate;
+    m_onDemand = enabled;
+    requestRedraw();
+  }
+
+  // Number of chunks the draw list is recorded in, in parallel on the job system. 1 records inline into the frame's
+  // primary command buffer, more than that splits the draw list over secondary command buffers. Takes effect at the
+  // next frame.
+  void setRecordThreads(uint32_t threads) { m_recordThreads = std::max(threads, 1u); }
+
+  // Whether the draw list is frustum culled on the CPU before recording, on by default. Instances are always culled
+  // on the GPU. Takes effect at the next frame.
+  void setCpuCulling(bool enabled) { m_cpuCulling = enabled; }
+
+  // How the render thread spaces out frames. framesPerSecond is only used by PACING_FIXED. Safe to call from any
+  // thread; takes effect at the next frame.
+  void setFramePacing(ePacingMode mode, double framesPerSecond)
+  {
+    m_pacingRate = framesPerSecond;
+    m_pacingMode = mode;
+  }
+
+  // Renders frameCount frames synchronously on the calling thread, appending one sample per frame. Only valid while
+  // attached without a render thread.
+  void runFrames(uint32_t frameCount, std::vector<sFrameSample> &samples)
+  {
+    if (isRunning) {
+      throw std::runtime_error("runFrames called while the render thread is running!");
+    }
+
+    samples.reserve(samples.size() + frameCount);
+    Timing<std::chrono::duration<double, std::ratio<1>>> t;
+    for (uint32_t i = 0; i < frameCount; i++) {
+      drawFrame();
+      m_lastSample.cpuFrame = t.tock().count();
+      samples.push_back(m_lastSample);
+    }
+
+    device->waitIdle();
+  }
 
   // bool framebufferResized = false;
   bool isRunning = false; // This should probably be atomic
 
 private:
-  PerformanceMonitorCallback performanceMonitorCallback = nullptr;
   SimpleCallback simpleCallback = nullptr;
 
-  sPerf m_perf;
+  TelemetryRing m_telemetry;
+  sFrameSample m_lastSample {};
+
+  bool m_headless = false;
 
   // GLFWwindow *window;
   std::thread m_thread;
-  SurfaceInfo m_surfaceInfo;
+  bool m_attached = false;
+
+  // Held by the thread rendering a frame for the whole frame, and by attach and detach while they change the viewports.
+  std::mutex m_frameMutex;
+  std::atomic<int> m_frameLockWaiters { 0 };
+  std::vector<Viewport *> m_viewports;
+  vk::Format renderPassFormat = vk::Format::eUndefined; // Every viewport's swapchain uses this format
+
+  // Sizes and cameras posted from other threads. Only the latest of each per viewport is applied, once per frame.
+  struct ViewportUpdate {
+    bool hasSize = false;
+    int width = 0;
+    int height = 0;
+    bool hasCamera = false;
+    Camera camera;
+  };
+  std::mutex m_updateMutex;
+  std::unordered_map<HWND, ViewportUpdate> m_pendingUpdates;
 
   Device *m_device = nullptr;
   vk::Device *device = nullptr;
+  MemoryAllocator *m_allocator = nullptr;
+  PipelineCache *m_pipelineCache = nullptr;
+  ShaderLibrary *m_shaders = nullptr;
+  ShaderWatcher *m_shaderWatcher = nullptr; // Pipeline 0 is graphicsPipeline, 1 instancedPipeline
+  std::string m_pipelineCachePath;
+  UploadService *m_uploads = nullptr;
 
   vk::Instance instance;
-  vk::SurfaceKHR surface;
-
-  vk::SwapchainKHR swapchain;
-  std::vector<vk::Image> swapchainImages;
-  vk::Format swapchainImageFormat;
-  vk::Extent2D swapchainExtent;
-  std::vector<vk::ImageView> swapchainImageViews;
-  std::vector<vk::Framebuffer> swapchainFramebuffers;
 
   vk::RenderPass renderPass;
   vk::DescriptorSetLayout descriptorSetLayout;
   vk::PipelineLayout pipelineLayout;
   vk::Pipeline graphicsPipeline;
+  vk::Pipeline instancedPipeline;
+
+  std::mutex pipelineMutex; // Held while building a pipeline
+  bool shadersFromFiles = false; // Set by the first shader reload, guarded by pipelineMutex
+
+  // Objects replaced while frames that use them may still be in flight (old pipelines, old swapchains).
+  DeletionQueue m_retired;
+  uint64_t frameNumber = 1;         // Of the frame being built. Only advances when a frame is submitted.
+  std::vector<uint64_t> slotFrames; // Per frame in flight, the last frame submitted with its fence, 0 if none
 
   vk::DescriptorPool descriptorPool;
   std::vector<vk::DescriptorSet> descriptorSets;
 
   vk::Buffer vertexBuffer;
-  vk::DeviceMemory vertexBufferMemory;
+  Allocation vertexBufferMemory;
   vk::Buffer indexBuffer;
-  vk::DeviceMemory indexBufferMemory;
-
-  std::vector<vk::Buffer> uniformBuffers;
-  std::vector<vk::DeviceMemory> uniformBuffersMemory;
-  std::vector<void *> uniformBuffersMapped;
-
-  std::vector<vk::CommandBuffer, std::allocator<vk::CommandBuffer>> commandBuffers;
-
-  std::vector<vk::Semaphore> imageAvailableSemaphores;
-  std::vector<vk::Semaphore> renderFinishedSemaphores;
+  Allocation indexBufferMemory;
+  uint32_t m_indexCount = 0;
+  vk::IndexType m_indexType = vk::IndexType::eUint16;
+  MeshFile *m_mesh = nullptr;      // Stays mapped so a re-attach can upload it again. nullptr for the built-in quad.
+  MeshFile *pendingMesh = nullptr; // Guarded by sceneMutex
+
+  UniformRing *m_uniforms = nullptr;
+
+  std::vector<DrawItem> drawItems;
+  bool animateScene = true;
+  std::mutex sceneMutex;
+  std::vector<DrawItem> pendingDrawItems;
+  bool hasPendingDrawItems = false;
+  TransformHierarchy m_transforms; // Guarded by sceneMutex
+
+  InstanceBuffer *m_instances = nullptr;
+  InstanceCuller *m_culler = nullptr; // Per attach, like the pipelines
+  float m_meshRadius = 0;            // Bounding sphere of the scene mesh, for culling
+
+  std::atomic<bool> m_cpuCulling = true;
+  BoundsStore m_drawBounds; // Bounding spheres of drawItems, rebuilt when they change
+  bool m_drawBoundsDirty = true;
+  std::vector<std::vector<uint32_t>> m_visibleDraws; // Per viewport, indices into drawItems
+  struct InstanceEdit {
+    size_t first;
+    std::vector<InstanceData> instances;
+  };
+  std::vector<InstanceData> pendingInstances; // Guarded by sceneMutex, like the edits
+  bool hasPendingInstances = false;
+  std::vector<InstanceEdit> pendingInstanceEdits;
+
+  std::atomic<uint32_t> m_recordThreads { 1 };
+
+  // On-demand rendering. m_redrawRequested is guarded by m_redrawMutex; m_needsAnotherFrame is set by a frame that
+  // couldn't finish the job (out of date swapchain, minimized window, running animation) and is render thread only.
+  std::atomic<bool> m_onDemand { false };
+  std::atomic<double> m_keepAliveRate { 0 };
+  std::mutex m_redrawMutex;
+  std::condition_variable m_redrawCondition;
+  bool m_redrawRequested = true;
+  bool m_needsAnotherFrame = false;
+
+  // Frame pacing of the render thread. Displays are paced at their refresh rate by default, so an idle editor doesn't
+  // spin the GPU at hundreds of frames per second.
+  std::atomic<ePacingMode> m_pacingMode { PACING_DISPLAY };
+  std::atomic<double> m_pacingRate { 60.0 };
+  FramePacer m_pacer;
+  double m_displayRate = -1; // Refresh rate of the first viewport's monitor. 0 if unknown, -1 until looked up
+  Timing<std::chrono::duration<double, std::ratio<1>>> displayRateTimer;
+  ParallelRecorder *m_recorder = nullptr;
+  JobSystem *m_jobs = nullptr;
+
+  // One transient pool per frame in flight. It is reset wholesale once the frame's fence has signaled and its single
+  // primary command buffer is recorded again from the current scene.
+  std::vector<vk::CommandPool> frameCommandPools;
+  std::vector<vk::CommandBuffer> frameCommandBuffers;
+
+  // Two timestamps (render pass begin/end) per frame in flight, read back once that frame's fence has signaled.
+  // frameTimestamped is false until a frame slot has actually written its pair.
+  vk::QueryPool timestampQueryPool;
+  bool timestampsSupported = false;
+  double timestampPeriod = 0; // Nanoseconds per tick
+  uint64_t timestampMask = ~0ull;
+  std::vector<bool> frameTimestamped;
+  Timing<std::chrono::duration<double, std::ratio<1>>> frameTimer;
+
+  std::vector<vk::Semaphore> renderFinishedSemaphores; // Signaled once per frame, waited on by the single present
   std::vector<vk::Fence> inFlightFences;
   size_t currentFrame = 0;
+  uint32_t m_framesInFlight = MAX_FRAMES_IN_FLIGHT;
+
+  // For threads other than the render thread. The render thread takes the lock again right after every frame, so it
+  // steps aside while someone is waiting for it.
+  std::unique_lock<std::mutex> lockFrames()
+  {
+    m_frameLockWaiters++;
+    std::unique_lock<std::mutex> lock(m_frameMutex);
+    m_frameLockWaiters--;
+    return lock;
+  }
 
-  void initVulkan()
+  void initVulkan(const SurfaceInfo &surfaceInfo)
   {
-    createSurface();
-    createSwapchain();
-    createImageViews();
+    Viewport *viewport = createViewport(surfaceInfo);
+    m_viewports.push_back(viewport);
+    createTimestampQueryPool();
     createRenderPass();
     createDescriptorSetLayout();
     createGraphicsPipeline();
-    createFramebuffers();
+    m_culler = new InstanceCuller(m_device, m_allocator, m_shaders, *m_pipelineCache, m_framesInFlight);
+    viewport->swapchain->createFramebuffers(renderPass);
+    createUploadService();
     createVertexBuffer();
     createIndexBuffer();
     createUniformBuffers();
     createDescriptorPool();
     createDescriptorSets();
-    createCommandBuffers();
+    createScene();
+    createCommandPools();
     createSyncObjects();
+    if (!m_headless) {
+      createShaderWatcher();
+    }
   }
 
 
-  // std::chrono::high_resolution_clock::time_point currentTime;
-  std::chrono::high_resolution_clock::time_point previousFrameTime = std::chrono::high_resolution_clock::now();
-  // #define TARGET_FRAMERATE 30
   void mainLoop()
   {
     Timing<std::chrono::duration<double, std::ratio<1>>> t;
     while (isRunning) {
+      waitForRedraw();
+      if (!isRunning) {
+        break;
+      }
 
-      // Cap framerate
-#ifdef TARGET_FRAMERATE
-      std::chrono::high_resolution_clock::time_point currentTime;
-      do {
-        currentTime = std::chrono::high_resolution_clock::now();
-      } while (currentTime - previousFrameTime < std::chrono::milliseconds(1000 / TARGET_FRAMERATE));
-      previousFrameTime = currentTime;
-#endif
+      m_lastSample.paceJitter = m_pacer.wait(framePeriod());
 
       drawFrame();
 
       auto delta = t.tock().count();
+      m_lastSample.cpuFrame = delta;
 
-      m_perf.frameDelta[m_perf.currentIndex] = delta;
-      m_perf.currentIndex = (m_perf.currentIndex + 1) % FRAME_DELTA_COUNT;
-      try {
-        if (performanceMonitorCallback) {
-          performanceMonitorCallback(m_perf);
-        }
-      }
-      catch (std::exception &e) {
-        vdb::debugOutput(e.what());
+      // Never blocks. If the UI stops polling, samples are dropped instead.
+      m_telemetry.push(m_lastSample);
+
+      while (m_frameLockWaiters > 0) {
+        std::this_thread::yield();
       }
     }
 
     device->waitIdle();
   }
 
-  void cleanupSwapchain()
+  // Blocks in on-demand mode until a frame was requested, the keep-alive interval has passed or the render thread is
+  // being stopped. Returns right away otherwise.
+  void waitForRedraw()
   {
-    for (auto framebuffer : swapchainFramebuffers) {
-      device->destroyFramebuffer(framebuffer);
+    std::unique_lock<std::mutex> lock(m_redrawMutex);
+    if (m_onDemand && !m_needsAnotherFrame) {
+      auto ready = [this]() { return m_redrawRequested || !isRunning || !m_onDemand; };
+      double keepAliveRate = m_keepAliveRate;
+      if (keepAliveRate > 0) {
+        m_redrawCondition.wait_for(lock, std::chrono::duration<double>(1.0 / keepAliveRate), ready);
+      }
+      else {
+        m_redrawCondition.wait(lock, ready);
+      }
     }
+    // Whatever is requested from here on needs another frame after this one.
+    m_redrawRequested = false;
+    m_needsAnotherFrame = false;
+  }
 
-    device->freeCommandBuffers(m_device->commandPool, commandBuffers);
+  // Seconds between frame starts for the current pacing mode, 0 for uncapped.
+  double framePeriod()
+  {
+    switch (m_pacingMode.load()) {
+    case PACING_FIXED:
+      return m_pacingRate > 0 ? 1.0 / m_pacingRate : 0;
+    case PACING_DISPLAY:
+      // Falls back to 60 Hz until the monitor has been looked up, or if it won't tell.
+      return 1.0 / (m_displayRate > 0 ? m_displayRate : 60.0);
+    default:
+      return 0;
+    }
+  }
 
-    device->destroyPipeline(graphicsPipeline);
-    device->destroyPipelineLayout(pipelineLayout);
-    device->destroyRenderPass(renderPass);
+  // Looks up the refresh rate of the monitor showing the first viewport. Windows can be dragged to another monitor at
+  // any time without us hearing about it, so this polls about once a second. Called during a frame, which keeps the
+  // viewports from changing underneath it.
+  void updateDisplayRate()
+  {
+    if (m_pacingMode != PACING_DISPLAY || (m_displayRate >= 0 && displayRateTimer.peek().count() < 1.0)) {
+      return;
+    }
+    displayRateTimer.tick();
+    m_displayRate = displayRefreshRate(m_viewports.empty() ? nullptr : m_viewports.front()->hwnd);
+  }
+
+  void cleanupViewports()
+  {
+    m_retired.flush();
 
-    for (auto imageView : swapchainImageViews) {
-      device->destroyImageView(imageView);
+    for (Viewport *viewport : m_viewports) {
+      destroyViewport(viewport);
     }
+    m_viewports.clear();
+    renderPassFormat = vk::Format::eUndefined;
 
-    device->destroySwapchainKHR(swapchain);
+    device->destroyPipeline(graphicsPipeline);
+    device->destroyPipeline(instancedPipeline);
+    device->destroyPipelineLayout(pipelineLayout);
+    delete m_culler;
+    m_culler = nullptr;
+    m_instances->release();
+    device->destroyRenderPass(renderPass);
   }
 
   void cleanup()
   {
-    // cleanupSwapchain();
+    // Surfaces have to go before the instance.
+    if (m_attached) {
+      detach();
+    }
+
+    delete m_shaderWatcher;
+    delete m_uniforms;
+    delete m_recorder;
+
+    for (auto pool : frameCommandPools) {
+      device->destroyCommandPool(pool);
+    }
 
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-      device->destroyBuffer(uniformBuffers[i]);
-      device->freeMemory(uniformBuffersMemory[i]);
+    if (timestampQueryPool) {
+      device->destroyQueryPool(timestampQueryPool);
     }
 
     device->destroyDescriptorPool(descriptorPool);
     device->destroyDescriptorSetLayout(descriptorSetLayout);
 
     device->destroyBuffer(vertexBuffer);
-    device->freeMemory(vertexBufferMemory);
+    m_allocator->free(vertexBufferMemory);
 
     device->destroyBuffer(indexBuffer);
-    device->freeMemory(indexBufferMemory);
+    m_allocator->free(indexBufferMemory);
 
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    for (size_t i = 0; i < inFlightFences.size(); i++) {
       device->destroySemaphore(renderFinishedSemaphores[i]);
-      device->destroySemaphore(imageAvailableSemaphores[i]);
       device->destroyFence(inFlightFences[i]);
     }
 
+    delete m_uploads;
+    delete m_instances;
+    delete m_jobs;
+    delete m_mesh;
+    delete pendingMesh;
+    delete m_shaders;
+    delete m_pipelineCache;
+    delete m_allocator;
     delete m_device;
 
-    instance.destroySurfaceKHR(surface);
-
     if (vdb::enableValidationLayers) {
       vdb::DestroyDebugUtilsMessengerEXT(instance, vdb::callback, nullptr);
     }
@@ -309,25 +756,142 @@ private:
     instance.destroy();
   }
 
-  void recreateSwapchain()
+  // Surface, swapchain and per-frame semaphores of a new viewport. Framebuffers are left to the caller: they need the
+  // render pass, which for the first viewport doesn't exist yet and is created for its format.
+  Viewport *createViewport(const SurfaceInfo &surfaceInfo)
   {
-    int width = 0, height = 0;
-    // while (width == 0 || height == 0) {
-    //   width = m_surfaceInfo.width;
-    //   height = m_surfaceInfo.height;
-    // }
-    std::cout << "Resized. new size: " << width << " " << height << std::endl;
+    Viewport *viewport = new Viewport();
+    viewport->hwnd = surfaceInfo.hwnd;
+    viewport->width = surfaceInfo.width;
+    viewport->height = surfaceInfo.height;
 
-    device->waitIdle();
+    try {
+      if (!m_headless) {
+        viewport->surface = createSurface(surfaceInfo.hwnd);
+      }
+      if (renderPassFormat == vk::Format::eUndefined) {
+        renderPassFormat = m_headless ? vk::Format::eB8G8R8A8Unorm
+                                      : Swapchain::chooseSurfaceFormat(
+                                            m_device->querySwapchainSupport(viewport->surface).formats
+                                        ).format;
+      }
+      viewport->swapchain = createSwapchain(viewport);
+
+      viewport->imageAvailableSemaphores.resize(m_framesInFlight);
+      for (size_t i = 0; i < m_framesInFlight; i++) {
+        viewport->imageAvailableSemaphores[i] = device->createSemaphore({});
+      }
+    }
+    catch (vk::SystemError) {
+      destroyViewport(viewport);
+      throw std::runtime_error("failed to create synchronization objects for a viewport!");
+    }
+    catch (...) {
+      destroyViewport(viewport);
+      throw;
+    }
+    return viewport;
+  }
 
-    cleanupSwapchain();
+  void addViewport(const SurfaceInfo &surfaceInfo)
+  {
+    for (Viewport *viewport : m_viewports) {
+      if (viewport->hwnd == surfaceInfo.hwnd) {
+        throw std::runtime_error("a viewport for this window is already attached!");
+      }
+    }
 
-    createSwapchain();
-    createImageViews();
-    createRenderPass();
-    createGraphicsPipeline();
-    createFramebuffers();
-    createCommandBuffers();
+    Viewport *viewport = createViewport(surfaceInfo);
+    try {
+      viewport->swapchain->createFramebuffers(renderPass);
+    }
+    catch (...) {
+      destroyViewport(viewport);
+      throw;
+    }
+    m_viewports.push_back(viewport);
+  }
+
+  // Only once no frame in flight uses the viewport and the swapchains it retired are gone.
+  void destroyViewport(Viewport *viewport)
+  {
+    delete viewport->swapchain;
+    for (auto semaphore : viewport->imageAvailableSemaphores) {
+      device->destroySemaphore(semaphore);
+    }
+    if (viewport->surface) {
+      instance.destroySurfaceKHR(viewport->surface);
+    }
+    delete viewport;
+  }
+
+  // oldSwapchain, if given, is the one being replaced.
+  Swapchain *createSwapchain(Viewport *viewport, Swapchain *oldSwapchain = nullptr)
+  {
+    vk::Extent2D extent = { static_cast<uint32_t>(std::max(viewport->width, 1)),
+                            static_cast<uint32_t>(std::max(viewport->height, 1)) };
+    if (m_headless) {
+      return new Swapchain(m_device, m_allocator, renderPassFormat, extent, m_framesInFlight);
+    }
+    return new Swapchain(
+        m_device,
+        viewport->surface,
+        renderPassFormat,
+        extent,
+        oldSwapchain ? static_cast<vk::SwapchainKHR>(*oldSwapchain) : nullptr
+    );
+  }
+
+  // Never waits for the device. Frames still in flight keep rendering to the old images; the old swapchain with its
+  // views and framebuffers is retired and destroyed once the last frame that used it has finished. Viewport and
+  // scissor are dynamic and every swapchain has the render pass format, so pipeline and render pass stay as they are.
+  //
+  // Returns false, leaving everything as it was, while the window has no area (minimized). isResized stays set then.
+  bool recreateSwapchain(Viewport *viewport)
+  {
+    if (!m_headless) {
+      vk::Extent2D extent = Swapchain::chooseExtent(
+          m_device->querySwapchainSupport(viewport->surface).capabilities,
+          { static_cast<uint32_t>(viewport->width), static_cast<uint32_t>(viewport->height) }
+      );
+      if (extent.width == 0 || extent.height == 0) {
+        return false;
+      }
+    }
+    viewport->isResized = false;
+
+    Swapchain *oldSwapchain = viewport->swapchain;
+    viewport->swapchain = createSwapchain(viewport, oldSwapchain);
+    viewport->swapchain->createFramebuffers(renderPass);
+    m_retired.push(frameNumber, [oldSwapchain]() { delete oldSwapchain; });
+    return true;
+  }
+
+  // Render thread, once per frame. Of everything posted since the last frame only the latest size and camera of each
+  // viewport are applied. Updates for windows that aren't attached are dropped.
+  void applyViewportUpdates()
+  {
+    std::unordered_map<HWND, ViewportUpdate> updates;
+    {
+      std::lock_guard<std::mutex> lock(m_updateMutex);
+      updates.swap(m_pendingUpdates);
+    }
+
+    for (Viewport *viewport : m_viewports) {
+      auto update = updates.find(viewport->hwnd);
+      if (update == updates.end()) {
+        continue;
+      }
+      if (update->second.hasCamera) {
+        viewport->camera = update->second.camera;
+      }
+      if (update->second.hasSize &&
+          (update->second.width != viewport->width || update->second.height != viewport->height)) {
+        viewport->width = update->second.width;
+        viewport->height = update->second.height;
+        viewport->isResized = true;
+      }
+    }
   }
 
   void createInstance()
@@ -368,118 +932,95 @@ private:
     }
   }
 
-  void createSurface()
+  vk::SurfaceKHR createSurface(HWND hwnd)
   {
-    HWND hwnd = m_surfaceInfo.hwnd;
     vk::Win32SurfaceCreateInfoKHR createInfo {};
     createInfo.flags = {};
     createInfo.hinstance = GetModuleHandle(nullptr);
     createInfo.hwnd = hwnd;
 
     try {
-      surface = instance.createWin32SurfaceKHR(createInfo, nullptr);
+      return instance.createWin32SurfaceKHR(createInfo, nullptr);
     }
     catch (vk::SystemError) {
       throw std::runtime_error("Failed to create window surface!");
     }
   }
 
-  void createSwapchain()
+  void createTimestampQueryPool()
   {
-    SwapchainSupportDetails swapchainSupport = m_device->querySwapchainSupport(surface);
-
-    vk::SurfaceFormatKHR surfaceFormat = chooseSwapSurfaceFormat(swapchainSupport.formats);
-    vk::PresentModeKHR presentMode = chooseSwapPresentMode(swapchainSupport.presentModes);
-    vk::Extent2D extent = chooseSwapExtent(swapchainSupport.capabilities);
+    vk::PhysicalDevice &physicalDevice = *m_device->getPhysicalDevice();
+    uint32_t graphicsFamily = m_device->findQueueFamilies().graphicsFamily.value();
+    uint32_t validBits = physicalDevice.getQueueFamilyProperties()[graphicsFamily].timestampValidBits;
 
-    uint32_t imageCount = swapchainSupport.capabilities.minImageCount + 1;
-    if (swapchainSupport.capabilities.maxImageCount > 0 && imageCount > swapchainSupport.capabilities.maxImageCount) {
-      imageCount = swapchainSupport.capabilities.maxImageCount;
+    if (timestampQueryPool) {
+      device->destroyQueryPool(timestampQueryPool);
+      timestampQueryPool = nullptr;
     }
 
-    vk::SwapchainCreateInfoKHR createInfo(
-        vk::SwapchainCreateFlagsKHR(),
-        surface,
-        imageCount,
-        surfaceFormat.format,
-        surfaceFormat.colorSpace,
-        extent,
-        1, // imageArrayLayers
-        vk::ImageUsageFlagBits::eColorAttachment
-    );
-
-    QueueFamilyIndices indices = m_device->findQueueFamilies();
-    uint32_t queueFamilyIndices[] = { indices.graphicsFamily.value(), indices.presentFamily.value() };
-
-    if (indices.graphicsFamily != indices.presentFamily) {
-      createInfo.imageSharingMode = vk::SharingMode::eConcurrent;
-      createInfo.queueFamilyIndexCount = 2;
-      createInfo.pQueueFamilyIndices = queueFamilyIndices;
-    }
-    else {
-      createInfo.imageSharingMode = vk::SharingMode::eExclusive;
+    timestampsSupported = validBits > 0;
+    frameTimestamped.assign(m_framesInFlight, false);
+    if (!timestampsSupported) {
+      vdb::debugOutput("Graphics queue does not support timestamps, GPU frame times will be 0.");
+      return;
     }
 
-    createInfo.preTransform = swapchainSupport.capabilities.currentTransform;
-    createInfo.compositeAlpha = vk::CompositeAlphaFlagBitsKHR::eOpaque;
-    createInfo.presentMode = presentMode;
-    createInfo.clipped = VK_TRUE;
+    timestampPeriod = physicalDevice.getProperties().limits.timestampPeriod;
+    timestampMask = validBits >= 64 ? ~0ull : ((1ull << validBits) - 1);
 
-    createInfo.oldSwapchain = vk::SwapchainKHR(nullptr);
+    vk::QueryPoolCreateInfo poolInfo = {};
+    poolInfo.queryType = vk::QueryType::eTimestamp;
+    poolInfo.queryCount = 2 * m_framesInFlight;
 
     try {
-      swapchain = device->createSwapchainKHR(createInfo);
+      timestampQueryPool = device->createQueryPool(poolInfo);
     }
     catch (vk::SystemError) {
-      throw std::runtime_error("failed to create swap chain!");
+      throw std::runtime_error("failed to create timestamp query pool!");
     }
-
-    swapchainImages = device->getSwapchainImagesKHR(swapchain);
-
-    swapchainImageFormat = surfaceFormat.format;
-    swapchainExtent = extent;
-    std::cout << "Created swapchain with extent " << extent.width << " " << extent.height << std::endl;
   }
 
-  void createImageViews()
+  // Only called after the fence of frame has signaled, so the results are already there and this never blocks.
+  // Returns 0 if the frame has not rendered anything yet.
+  double readGpuFrameTime(size_t frame)
   {
-    swapchainImageViews.resize(swapchainImages.size());
+    if (!timestampsSupported || !frameTimestamped[frame]) {
+      return 0;
+    }
 
-    for (size_t i = 0; i < swapchainImages.size(); i++) {
-      vk::ImageViewCreateInfo createInfo = {};
-      createInfo.image = swapchainImages[i];
-      createInfo.viewType = vk::ImageViewType::e2D;
-      createInfo.format = swapchainImageFormat;
-      createInfo.components.r = vk::ComponentSwizzle::eIdentity;
-      createInfo.components.g = vk::ComponentSwizzle::eIdentity;
-      createInfo.components.b = vk::ComponentSwizzle::eIdentity;
-      createInfo.components.a = vk::ComponentSwizzle::eIdentity;
-      createInfo.subresourceRange.aspectMask = vk::ImageAspectFlagBits::eColor;
-      createInfo.subresourceRange.baseMipLevel = 0;
-      createInfo.subresourceRange.levelCount = 1;
-      createInfo.subresourceRange.baseArrayLayer = 0;
-      createInfo.subresourceRange.layerCount = 1;
+    // Per query: the timestamp followed by its availability word.
+    uint64_t data[4] = {};
+    vk::Result result = device->getQueryPoolResults(
+        timestampQueryPool,
+        static_cast<uint32_t>(2 * frame),
+        2,
+        sizeof(data),
+        data,
+        2 * sizeof(uint64_t),
+        vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWithAvailability
+    );
 
-      try {
-        swapchainImageViews[i] = device->createImageView(createInfo);
-      }
-      catch (vk::SystemError) {
-        throw std::runtime_error("failed to create image views!");
-      }
+    if ((result != vk::Result::eSuccess && result != vk::Result::eNotReady) || data[1] == 0 || data[3] == 0) {
+      return 0;
     }
+
+    uint64_t ticks = (data[2] - data[0]) & timestampMask;
+    return ticks * timestampPeriod * 1e-9;
   }
 
   void createRenderPass()
   {
     vk::AttachmentDescription colorAttachment = {};
-    colorAttachment.format = swapchainImageFormat;
+    colorAttachment.format = renderPassFormat;
     colorAttachment.samples = vk::SampleCountFlagBits::e1;
     colorAttachment.loadOp = vk::AttachmentLoadOp::eClear;
     colorAttachment.storeOp = vk::AttachmentStoreOp::eStore;
     colorAttachment.stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
     colorAttachment.stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
     colorAttachment.initialLayout = vk::ImageLayout::eUndefined;
-    colorAttachment.finalLayout = vk::ImageLayout::ePresentSrcKHR;
+    // Offscreen images are never presented. Leave them ready to be copied out instead.
+    colorAttachment.finalLayout =
+        m_headless ? vk::ImageLayout::eTransferSrcOptimal : vk::ImageLayout::ePresentSrcKHR;
 
     vk::AttachmentReference colorAttachmentRef = {};
     colorAttachmentRef.attachment = 0;
@@ -518,7 +1059,7 @@ private:
   {
     vk::DescriptorSetLayoutBinding uboLayoutBinding {};
     uboLayoutBinding.binding = 0;
-    uboLayoutBinding.descriptorType = vk::DescriptorType::eUniformBuffer;
+    uboLayoutBinding.descriptorType = vk::DescriptorType::eUniformBufferDynamic;
     uboLayoutBinding.descriptorCount = 1;
 
     uboLayoutBinding.stageFlags = vk::ShaderStageFlagBits::eVertex;
@@ -536,50 +1077,69 @@ private:
 
   void createGraphicsPipeline()
   {
-    auto vertShaderCode = readFile("shaders/vert.spv");
-    auto fragShaderCode = readFile("shaders/frag.spv");
+    vk::PipelineLayoutCreateInfo pipelineLayoutInfo = {};
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
+    pipelineLayoutInfo.pushConstantRangeCount = 0;
+
+    try {
+      pipelineLayout = device->createPipelineLayout(pipelineLayoutInfo);
+    }
+    catch (vk::SystemError) {
+      throw std::runtime_error("failed to create pipeline layout!");
+    }
 
-    auto vertShaderModule = createShaderModule(vertShaderCode);
-    auto fragShaderModule = createShaderModule(fragShaderCode);
+    graphicsPipeline = buildGraphicsPipeline(pipelineShaders, false, shadersFromFiles);
+    instancedPipeline = buildGraphicsPipeline(instancedShaders, true, shadersFromFiles);
+  }
+
+  // Builds a pipeline from shaders (vertex, fragment) for the current render pass and layout, from the shaders
+  // compiled into the binary or, once a reload has happened, from the SPIR-V on disk. An instanced pipeline also reads
+  // InstanceData from binding 1. Also called from the shader watcher threads.
+  vk::Pipeline buildGraphicsPipeline(const std::vector<WatchedShader> &shaders, bool instanced, bool fromFiles)
+  {
+    vk::ShaderModule vertShaderModule = m_shaders->load(shaders[0].spirv, fromFiles);
+    vk::ShaderModule fragShaderModule = m_shaders->load(shaders[1].spirv, fromFiles);
 
     vk::PipelineShaderStageCreateInfo shaderStages[] = {
-      {vk::PipelineShaderStageCreateFlags(),   vk::ShaderStageFlagBits::eVertex, *vertShaderModule, "main"},
-      {vk::PipelineShaderStageCreateFlags(), vk::ShaderStageFlagBits::eFragment, *fragShaderModule, "main"}
+      {vk::PipelineShaderStageCreateFlags(),   vk::ShaderStageFlagBits::eVertex, vertShaderModule, "main"},
+      {vk::PipelineShaderStageCreateFlags(), vk::ShaderStageFlagBits::eFragment, fragShaderModule, "main"}
     };
 
     vk::PipelineVertexInputStateCreateInfo vertexInputInfo = {};
     vertexInputInfo.vertexBindingDescriptionCount = 0;
     vertexInputInfo.vertexAttributeDescriptionCount = 0;
 
-    auto bindingDescription = Vertex::getBindingDescription();
-    auto attributeDescriptions = Vertex::getAttributeDescriptions();
+    std::vector<vk::VertexInputBindingDescription> bindingDescriptions = { Vertex::getBindingDescription() };
+    auto vertexAttributes = Vertex::getAttributeDescriptions();
+    std::vector<vk::VertexInputAttributeDescription> attributeDescriptions(
+        vertexAttributes.begin(),
+        vertexAttributes.end()
+    );
+    if (instanced) {
+      bindingDescriptions.push_back(InstanceData::getBindingDescription());
+      auto instanceAttributes = InstanceData::getAttributeDescriptions();
+      attributeDescriptions.insert(attributeDescriptions.end(), instanceAttributes.begin(), instanceAttributes.end());
+    }
 
-    vertexInputInfo.vertexBindingDescriptionCount = 1;
+    vertexInputInfo.vertexBindingDescriptionCount = static_cast<uint32_t>(bindingDescriptions.size());
     vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
-    vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
+    vertexInputInfo.pVertexBindingDescriptions = bindingDescriptions.data();
     vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
 
     vk::PipelineInputAssemblyStateCreateInfo inputAssembly = {};
     inputAssembly.topology = vk::PrimitiveTopology::eTriangleList;
     inputAssembly.primitiveRestartEnable = VK_FALSE;
 
-    vk::Viewport viewport = {};
-    viewport.x = 0.0f;
-    viewport.y = 0.0f;
-    viewport.width = (float)swapchainExtent.width;
-    viewport.height = (float)swapchainExtent.height;
-    viewport.minDepth = 0.0f;
-    viewport.maxDepth = 1.0f;
-
-    vk::Rect2D scissor = {};
-    scissor.offset = vk::Offset2D { 0, 0 };
-    scissor.extent = swapchainExtent;
-
+    // Viewport and scissor are set while recording, so the pipeline doesn't depend on the swapchain extent.
     vk::PipelineViewportStateCreateInfo viewportState = {};
     viewportState.viewportCount = 1;
-    viewportState.pViewports = &viewport;
     viewportState.scissorCount = 1;
-    viewportState.pScissors = &scissor;
+
+    vk::DynamicState dynamicStates[] = { vk::DynamicState::eViewport, vk::DynamicState::eScissor };
+    vk::PipelineDynamicStateCreateInfo dynamicState = {};
+    dynamicState.dynamicStateCount = 2;
+    dynamicState.pDynamicStates = dynamicStates;
 
     vk::PipelineRasterizationStateCreateInfo rasterizer = {};
     rasterizer.depthClampEnable = VK_FALSE;
@@ -609,18 +1169,6 @@ private:
     colorBlending.blendConstants[2] = 0.0f;
     colorBlending.blendConstants[3] = 0.0f;
 
-    vk::PipelineLayoutCreateInfo pipelineLayoutInfo = {};
-    pipelineLayoutInfo.setLayoutCount = 1;
-    pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
-    pipelineLayoutInfo.pushConstantRangeCount = 0;
-
-    try {
-      pipelineLayout = device->createPipelineLayout(pipelineLayoutInfo);
-    }
-    catch (vk::SystemError) {
-      throw std::runtime_error("failed to create pipeline layout!");
-    }
-
     vk::GraphicsPipelineCreateInfo pipelineInfo = {};
     pipelineInfo.stageCount = 2;
     pipelineInfo.pStages = shaderStages;
@@ -630,54 +1178,80 @@ private:
     pipelineInfo.pRasterizationState = &rasterizer;
     pipelineInfo.pMultisampleState = &multisampling;
     pipelineInfo.pColorBlendState = &colorBlending;
+    pipelineInfo.pDynamicState = &dynamicState;
     pipelineInfo.layout = pipelineLayout;
     pipelineInfo.renderPass = renderPass;
     pipelineInfo.subpass = 0;
     pipelineInfo.basePipelineHandle = nullptr;
 
     try {
-      graphicsPipeline = device->createGraphicsPipeline(nullptr, pipelineInfo).value;
+      return device->createGraphicsPipeline(*m_pipelineCache, pipelineInfo).value;
     }
     catch (vk::SystemError) {
       throw std::runtime_error("failed to create graphics pipeline!");
     }
   }
 
-  void createFramebuffers()
+  // One watcher for both pipelines, so the shared fragment shader is compiled once and a change to it rebuilds both.
+  void createShaderWatcher()
   {
-    swapchainFramebuffers.resize(swapchainImageViews.size());
+    auto rebuild = [this](const std::vector<WatchedShader> &shaders, bool instanced) {
+      return [this, &shaders, instanced]() {
+        std::lock_guard<std::mutex> lock(pipelineMutex);
+        vk::Pipeline pipeline = buildGraphicsPipeline(shaders, instanced, true);
+        // From now on the files are the newer shaders, also when the renderer is attached again.
+        shadersFromFiles = true;
+        return pipeline;
+      };
+    };
 
-    for (size_t i = 0; i < swapchainImageViews.size(); i++) {
-      vk::ImageView attachments[] = { swapchainImageViews[i] };
+    delete m_shaderWatcher;
+    m_shaderWatcher = new ShaderWatcher(m_device,
+                                        { { pipelineShaders, rebuild(pipelineShaders, false) },
+                                          { instancedShaders, rebuild(instancedShaders, true) } },
+                                        [this]() { requestRedraw(); });
+  }
 
-      vk::FramebufferCreateInfo framebufferInfo = {};
-      framebufferInfo.renderPass = renderPass;
-      framebufferInfo.attachmentCount = 1;
-      framebufferInfo.pAttachments = attachments;
-      framebufferInfo.width = swapchainExtent.width;
-      framebufferInfo.height = swapchainExtent.height;
-      framebufferInfo.layers = 1;
+  // Called at the start of every frame, after its fence. Entries are tagged with the frameNumber being built when they
+  // were retired, and slotFrames holds the number of the last frame submitted with this fence. That frame has finished,
+  // and every frame submitted before it, so every entry tagged with its number or lower can go. Frames that bail out
+  // before their submit don't advance frameNumber or slotFrames, so they never let retirement run ahead of the GPU.
+  void collectRetired()
+  {
+    m_retired.collect(slotFrames[currentFrame]);
+  }
 
-      try {
-        swapchainFramebuffers[i] = device->createFramebuffer(framebufferInfo);
-      }
-      catch (vk::SystemError) {
-        throw std::runtime_error("failed to create framebuffer!");
-      }
+  // Swaps in pipelines the shader watcher finished. The replaced ones may still be in use by frames in flight.
+  void updatePipelines()
+  {
+    if (!m_shaderWatcher) {
+      return;
+    }
+    updatePipeline(0, graphicsPipeline);
+    updatePipeline(1, instancedPipeline);
+  }
+
+  void updatePipeline(size_t index, vk::Pipeline &current)
+  {
+    vk::Pipeline pipeline = m_shaderWatcher->takePipeline(index);
+    if (pipeline) {
+      vk::Pipeline oldPipeline = current;
+      m_retired.push(frameNumber, [this, oldPipeline]() { device->destroyPipeline(oldPipeline); });
+      current = pipeline;
     }
   }
 
   void createDescriptorPool()
   {
     vk::DescriptorPoolSize poolSize {};
-    poolSize.type = vk::DescriptorType::eUniformBuffer;
-    poolSize.descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+    poolSize.type = vk::DescriptorType::eUniformBufferDynamic;
+    poolSize.descriptorCount = m_framesInFlight;
 
     vk::DescriptorPoolCreateInfo poolInfo {};
     poolInfo.poolSizeCount = 1;
     poolInfo.pPoolSizes = &poolSize;
 
-    poolInfo.maxSets = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+    poolInfo.maxSets = m_framesInFlight;
 
     if (device->createDescriptorPool(&poolInfo, nullptr, &descriptorPool) != vk::Result::eSuccess) {
       throw std::runtime_error("failed to create descriptor pool!");
@@ -686,20 +1260,26 @@ private:
 
   void createDescriptorSets()
   {
-    std::vector<vk::DescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, descriptorSetLayout);
+    std::vector<vk::DescriptorSetLayout> layouts(m_framesInFlight, descriptorSetLayout);
     vk::DescriptorSetAllocateInfo allocInfo {};
     allocInfo.descriptorPool = descriptorPool;
-    allocInfo.descriptorSetCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+    allocInfo.descriptorSetCount = m_framesInFlight;
     allocInfo.pSetLayouts = layouts.data();
 
-    descriptorSets.resize(MAX_FRAMES_IN_FLIGHT);
+    descriptorSets.resize(m_framesInFlight);
     if (device->allocateDescriptorSets(&allocInfo, descriptorSets.data()) != vk::Result::eSuccess) {
       throw std::runtime_error("failed to allocate descriptor sets!");
     }
 
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    writeDescriptorSets();
+  }
+
+  // Points each frame's descriptor set at that frame's uniform ring buffer.
+  void writeDescriptorSets()
+  {
+    for (size_t i = 0; i < m_framesInFlight; i++) {
       vk::DescriptorBufferInfo bufferInfo {};
-      bufferInfo.buffer = uniformBuffers[i];
+      bufferInfo.buffer = m_uniforms->getBuffer(i);
       bufferInfo.offset = 0;
       bufferInfo.range = sizeof(UniformBufferObject);
 
@@ -708,7 +1288,7 @@ private:
       descriptorWrite.dstBinding = 0;
       descriptorWrite.dstArrayElement = 0;
 
-      descriptorWrite.descriptorType = vk::DescriptorType::eUniformBuffer;
+      descriptorWrite.descriptorType = vk::DescriptorType::eUniformBufferDynamic;
       descriptorWrite.descriptorCount = 1;
 
       descriptorWrite.pBufferInfo = &bufferInfo;
@@ -719,23 +1299,24 @@ private:
     }
   }
 
+  // Vertex and index data go through the upload service. The copies are submitted with the first frame, which waits
+  // for them, so attaching does not block on the GPU. A loaded mesh is copied straight from its file mapping.
   void createVertexBuffer()
   {
+    const void *data = vertices.data();
     vk::DeviceSize bufferSize = sizeof(vertices[0]) * vertices.size();
 
-    vk::Buffer stagingBuffer;
-    vk::DeviceMemory stagingBufferMemory;
-    createBuffer(
-        bufferSize,
-        vk::BufferUsageFlagBits::eTransferSrc,
-        vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
-        stagingBuffer,
-        stagingBufferMemory
-    );
-
-    void *data = device->mapMemory(stagingBufferMemory, 0, bufferSize);
-    memcpy(data, vertices.data(), (size_t)bufferSize);
-    device->unmapMemory(stagingBufferMemory);
+    if (m_mesh) {
+      data = m_mesh->getVertexData();
+      bufferSize = m_mesh->getVertexBytes();
+      m_meshRadius = m_mesh->getRadius();
+    }
+    else {
+      m_meshRadius = 0;
+      for (const Vertex &vertex : vertices) {
+        m_meshRadius = std::max(m_meshRadius, glm::length(vertex.pos));
+      }
+    }
 
     createBuffer(
         bufferSize,
@@ -745,31 +1326,29 @@ private:
         vertexBufferMemory
     );
 
-    copyBuffer(stagingBuffer, vertexBuffer, bufferSize);
-
-    device->destroyBuffer(stagingBuffer);
-    device->freeMemory(stagingBufferMemory);
+    m_uploads->upload(
+        vertexBuffer,
+        0,
+        data,
+        bufferSize,
+        vk::PipelineStageFlagBits::eVertexInput,
+        vk::AccessFlagBits::eVertexAttributeRead
+    );
   }
 
-  // (TODO) this is very similar to createVertexBuffer. The two functions could
-  // probably be merged
   void createIndexBuffer()
   {
+    const void *data = indices.data();
     vk::DeviceSize bufferSize = sizeof(indices[0]) * indices.size();
-
-    vk::Buffer stagingBuffer;
-    vk::DeviceMemory stagingBufferMemory;
-    createBuffer(
-        bufferSize,
-        vk::BufferUsageFlagBits::eTransferSrc,
-        vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
-        stagingBuffer,
-        stagingBufferMemory
-    );
-
-    void *data = device->mapMemory(stagingBufferMemory, 0, bufferSize);
-    memcpy(data, indices.data(), (size_t)bufferSize);
-    device->unmapMemory(stagingBufferMemory);
+    m_indexCount = static_cast<uint32_t>(indices.size());
+    m_indexType = vk::IndexType::eUint16;
+
+    if (m_mesh) {
+      data = m_mesh->getIndexData();
+      bufferSize = m_mesh->getIndexBytes();
+      m_indexCount = m_mesh->getIndexCount();
+      m_indexType = m_mesh->getIndexSize() == 4 ? vk::IndexType::eUint32 : vk::IndexType::eUint16;
+    }
 
     createBuffer(
         bufferSize,
@@ -779,51 +1358,191 @@ private:
         indexBufferMemory
     );
 
-    copyBuffer(stagingBuffer, indexBuffer, bufferSize);
-
-    device->destroyBuffer(stagingBuffer);
-    device->freeMemory(stagingBufferMemory);
+    m_uploads->upload(
+        indexBuffer,
+        0,
+        data,
+        bufferSize,
+        vk::PipelineStageFlagBits::eVertexInput,
+        vk::AccessFlagBits::eIndexRead
+    );
   }
 
-  void createUniformBuffers()
+  // Swaps in a mesh posted by loadMesh. Frames in flight may still draw with the old buffers, so those are retired
+  // rather than destroyed.
+  void replaceMesh(MeshFile *mesh)
   {
-    vk::DeviceSize bufferSize = sizeof(UniformBufferObject);
+    vk::Buffer oldVertexBuffer = vertexBuffer;
+    Allocation oldVertexMemory = vertexBufferMemory;
+    vk::Buffer oldIndexBuffer = indexBuffer;
+    Allocation oldIndexMemory = indexBufferMemory;
+    m_retired.push(frameNumber, [this, oldVertexBuffer, oldVertexMemory, oldIndexBuffer, oldIndexMemory]() mutable {
+      device->destroyBuffer(oldVertexBuffer);
+      m_allocator->free(oldVertexMemory);
+      device->destroyBuffer(oldIndexBuffer);
+      m_allocator->free(oldIndexMemory);
+    });
+
+    delete m_mesh;
+    m_mesh = mesh;
+    createVertexBuffer();
+    createIndexBuffer();
+    m_drawBoundsDirty = true; // The radius changed
+  }
 
-    uniformBuffers.resize(MAX_FRAMES_IN_FLIGHT);
-    uniformBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
-    uniformBuffersMapped.resize(MAX_FRAMES_IN_FLIGHT);
+  void createUploadService()
+  {
+    delete m_uploads;
+    m_uploads = new UploadService(m_device, m_allocator, m_framesInFlight);
+  }
 
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-      createBuffer(
-          bufferSize,
-          vk::BufferUsageFlagBits::eUniformBuffer,
-          vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
-          uniformBuffers[i],
-          uniformBuffersMemory[i]
-      );
+  // Uniform data lives in a per-frame ring and is bound with dynamic offsets, one descriptor set per frame in flight.
+  void createUniformBuffers()
+  {
+    delete m_uniforms;
+    m_uniforms = new UniformRing(m_device, m_allocator, m_framesInFlight);
+  }
 
-      uniformBuffersMapped[i] = device->mapMemory(uniformBuffersMemory[i], 0, bufferSize);
+  // Keeps a draw list and instances set before a re-attach. The instances are uploaded again with the first frames.
+  void createScene()
+  {
+    if (drawItems.empty()) {
+      drawItems.assign(1, { glm::mat4(1.0f) });
     }
+    m_instances->reset(m_framesInFlight);
   }
 
-  void updateUniformBuffer(uint32_t currentImage)
+  void updateScene()
   {
+    MeshFile *mesh = nullptr;
+    {
+      std::lock_guard<std::mutex> lock(sceneMutex);
+      std::swap(mesh, pendingMesh);
+      if (hasPendingDrawItems) {
+        drawItems.swap(pendingDrawItems);
+        pendingDrawItems.clear();
+        hasPendingDrawItems = false;
+        animateScene = false;
+        m_drawBoundsDirty = true;
+        if (m_transforms.size() > 0) {
+          m_transforms.markAllDirty();
+        }
+      }
+      if (m_transforms.hasChanges()) {
+        applyTransforms();
+      }
+      if (hasPendingInstances) {
+        m_instances->assign(std::move(pendingInstances));
+        pendingInstances = {};
+        hasPendingInstances = false;
+      }
+      for (const InstanceEdit &edit : pendingInstanceEdits) {
+        m_instances->update(edit.first, edit.instances.data(), edit.instances.size());
+      }
+      pendingInstanceEdits.clear();
+    }
+    if (mesh) {
+      replaceMesh(mesh);
+    }
+    m_instances->flush(currentFrame, *m_uploads);
+    // One slot per draw plus one for the instanced draw, in every viewport.
+    reserveUniforms((drawItems.size() + 1) * m_viewports.size());
+
+    if (!animateScene || drawItems.empty()) {
+      return;
+    }
+    m_needsAnotherFrame = true; // The built-in animation never settles
+
     static auto startTime = std::chrono::high_resolution_clock::now();
     auto currentTime = std::chrono::high_resolution_clock::now();
 
     float time = std::chrono::duration<float, std::chrono::seconds::period>(currentTime - startTime).count();
 
-    UniformBufferObject ubo {};
-    ubo.model = glm::rotate(glm::mat4(1.0f), time * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+    drawItems[0].model = glm::rotate(glm::mat4(1.0f), time * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+    m_drawBoundsDirty = true;
+  }
 
-    ubo.view = glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+  // Writes the world matrices of the nodes that moved into the draw list, and their bounds if those are otherwise up
+  // to date. Under sceneMutex.
+  void applyTransforms()
+  {
+    if (drawItems.size() != m_transforms.size()) {
+      drawItems.resize(m_transforms.size(), { glm::mat4(1.0f) });
+      animateScene = false;
+      m_drawBoundsDirty = true;
+      m_transforms.markAllDirty();
+    }
 
-    ubo.proj =
-        glm::perspective(glm::radians(30.0f), swapchainExtent.width / (float)swapchainExtent.height, 0.1f, 10.0f);
+    bool patchBounds = !m_drawBoundsDirty;
+    m_transforms.update(
+        [&](TransformHierarchy::NodeId id, const glm::mat4 &world) {
+          drawItems[id].model = world;
+          if (patchBounds) {
+            updateDrawBound(id);
+          }
+        },
+        m_jobs
+    );
+  }
+
+  void updateDrawBounds()
+  {
+    m_drawBounds.resize(drawItems.size());
+    for (size_t i = 0; i < drawItems.size(); i++) {
+      updateDrawBound(i);
+    }
+    m_drawBoundsDirty = false;
+  }
+
+  // The mesh's bounding sphere placed by draw i's model matrix. The largest axis scale keeps it conservative for
+  // non-uniform scales.
+  void updateDrawBound(size_t i)
+  {
+    const glm::mat4 &model = drawItems[i].model;
+    float scale = std::sqrt(std::max({
+        glm::dot(glm::vec3(model[0]), glm::vec3(model[0])),
+        glm::dot(glm::vec3(model[1]), glm::vec3(model[1])),
+        glm::dot(glm::vec3(model[2]), glm::vec3(model[2])),
+    }));
+    m_drawBounds.set(i, glm::vec3(model[3]), m_meshRadius * scale);
+  }
+
+  // Grows the uniform ring when the draw list no longer fits.
+  void reserveUniforms(size_t drawCount)
+  {
+    vk::DeviceSize needed = m_uniforms->stride(sizeof(UniformBufferObject)) * drawCount;
+    if (needed <= m_uniforms->getCapacity()) {
+      return;
+    }
+
+    // Frames in flight may still read the old ring through the old descriptor sets, so both are retired rather than
+    // waited on. Growing at least twofold keeps a draw list that grows a little every frame from ending up here again.
+    UniformRing *oldUniforms = m_uniforms;
+    vk::DescriptorPool oldPool = descriptorPool;
+    m_retired.push(frameNumber, [this, oldUniforms, oldPool]() {
+      delete oldUniforms;
+      device->destroyDescriptorPool(oldPool);
+    });
+
+    vk::DeviceSize capacity = std::max(needed, 2 * oldUniforms->getCapacity());
+    m_uniforms = new UniformRing(m_device, m_allocator, m_framesInFlight, capacity);
+    createDescriptorPool();
+    createDescriptorSets();
+  }
 
-    ubo.proj[1][1] *= -1;
+  // (Re)creates the parallel recorder when the requested thread count changed.
+  void updateRecorder()
+  {
+    uint32_t threads = m_recordThreads;
+    uint32_t current = m_recorder ? m_recorder->getThreadCount() : 1;
+    if (threads == current) {
+      return;
+    }
 
-    memcpy(uniformBuffersMapped[currentImage], &ubo, sizeof(ubo));
+    // Its pools may still be in use by frames in flight.
+    device->waitIdle();
+    delete m_recorder;
+    m_recorder = threads > 1 ? new ParallelRecorder(m_device, m_jobs, m_framesInFlight, threads) : nullptr;
   }
 
   void createBuffer(
@@ -831,7 +1550,7 @@ private:
       vk::BufferUsageFlags usage,
       vk::MemoryPropertyFlags properties,
       vk::Buffer &buffer,
-      vk::DeviceMemory &bufferMemory
+      Allocation &bufferMemory
   )
   {
     vk::BufferCreateInfo bufferInfo = {};
@@ -846,87 +1565,129 @@ private:
       throw std::runtime_error("failed to create buffer!");
     }
 
-    vk::MemoryRequirements memRequirements = device->getBufferMemoryRequirements(buffer);
+    bufferMemory = m_allocator->allocate(device->getBufferMemoryRequirements(buffer), properties);
+    m_allocator->bindBuffer(buffer, bufferMemory);
+  }
+
+
+  void createCommandPools()
+  {
+    uint32_t graphicsFamily = m_device->findQueueFamilies().graphicsFamily.value();
+
+    // Created on demand by updateRecorder, for the current number of frames in flight.
+    delete m_recorder;
+    m_recorder = nullptr;
 
-    vk::MemoryAllocateInfo allocInfo = {};
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = m_device->findMemoryType(memRequirements.memoryTypeBits, properties);
+    frameCommandPools.resize(m_framesInFlight);
+    frameCommandBuffers.resize(m_framesInFlight);
 
     try {
-      bufferMemory = device->allocateMemory(allocInfo);
+      for (size_t i = 0; i < m_framesInFlight; i++) {
+        frameCommandPools[i] = device->createCommandPool({ vk::CommandPoolCreateFlagBits::eTransient, graphicsFamily });
+        frameCommandBuffers[i] = device->allocateCommandBuffers(
+            { frameCommandPools[i], vk::CommandBufferLevel::ePrimary, 1 }
+        )[0];
+      }
     }
     catch (vk::SystemError) {
-      throw std::runtime_error("failed to allocate buffer memory!");
+      throw std::runtime_error("failed to create frame command pools!");
     }
-
-    device->bindBufferMemory(buffer, bufferMemory, 0);
   }
 
-  void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size)
+  // Records the frame's command buffer from scratch, one render pass per viewport. Only called after the frame's fence
+  // has signaled, so the pool and the frame's part of the uniform ring can be reused.
+  void recordCommandBuffer(size_t frame, const std::vector<Viewport *> &viewports)
   {
-    vk::CommandBufferAllocateInfo allocInfo = {};
-    allocInfo.level = vk::CommandBufferLevel::ePrimary;
-    allocInfo.commandPool = m_device->commandPool;
-    allocInfo.commandBufferCount = 1;
+    updateRecorder();
+    device->resetCommandPool(frameCommandPools[frame]);
+    m_uniforms->begin(frame);
 
-    vk::CommandBuffer commandBuffer = device->allocateCommandBuffers(allocInfo)[0];
+    vk::CommandBuffer commandBuffer = frameCommandBuffers[frame];
 
     vk::CommandBufferBeginInfo beginInfo = {};
     beginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
 
-    commandBuffer.begin(beginInfo);
-
-    vk::BufferCopy copyRegion = {};
-    copyRegion.srcOffset = 0; // Optional
-    copyRegion.dstOffset = 0; // Optional
-    copyRegion.size = size;
-    commandBuffer.copyBuffer(srcBuffer, dstBuffer, copyRegion);
-
-    commandBuffer.end();
-
-    vk::SubmitInfo submitInfo = {};
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &commandBuffer;
-
-    m_device->graphicsQueue.submit(submitInfo, nullptr);
-    m_device->graphicsQueue.waitIdle();
-
-    device->freeCommandBuffers(m_device->commandPool, commandBuffer);
-  }
-
-
-  void createCommandBuffers()
-  {
-    commandBuffers.resize(swapchainFramebuffers.size());
-
-    vk::CommandBufferAllocateInfo allocInfo = {};
-    allocInfo.commandPool = m_device->commandPool;
-    allocInfo.level = vk::CommandBufferLevel::ePrimary;
-    allocInfo.commandBufferCount = (uint32_t)commandBuffers.size();
-
     try {
-      commandBuffers = device->allocateCommandBuffers(allocInfo);
+      commandBuffer.begin(beginInfo);
     }
     catch (vk::SystemError) {
-      throw std::runtime_error("failed to allocate command buffers!");
+      throw std::runtime_error("failed to begin recording command buffer!");
     }
 
-    for (size_t i = 0; i < commandBuffers.size(); i++) {
-      vk::CommandBufferBeginInfo beginInfo = {};
-      beginInfo.flags = vk::CommandBufferUsageFlagBits::eSimultaneousUse;
+    if (timestampsSupported) {
+      commandBuffer.resetQueryPool(timestampQueryPool, static_cast<uint32_t>(2 * frame), 2);
+      commandBuffer.writeTimestamp(
+          vk::PipelineStageFlagBits::eTopOfPipe,
+          timestampQueryPool,
+          static_cast<uint32_t>(2 * frame)
+      );
+    }
 
-      try {
-        commandBuffers[i].begin(beginInfo);
-      }
-      catch (vk::SystemError) {
-        throw std::runtime_error("failed to begin recording command buffer!");
-      }
+    // One uniform slot per draw and viewport, plus one per viewport for the instanced draw, allocated up front so the
+    // recording threads never touch the ring.
+    size_t drawCount = drawItems.size();
+    size_t slotCount = drawCount + 1;
+    UniformSlice uniforms = m_uniforms->allocateArray(sizeof(UniformBufferObject), slotCount * viewports.size());
+
+    bool hasInstances = m_instances->size() > 0;
+
+    std::vector<UniformBufferObject> cameras(viewports.size());
+    std::vector<glm::mat4> viewProjections(viewports.size());
+    for (size_t pass = 0; pass < viewports.size(); pass++) {
+      const Camera &camera = viewports[pass]->camera;
+      vk::Extent2D extent = viewports[pass]->swapchain->getExtent();
+      UniformBufferObject &ubo = cameras[pass];
+      ubo.view = glm::lookAt(camera.eye, camera.target, camera.up);
+      ubo.proj =
+          glm::perspective(camera.fovY, extent.width / (float)extent.height, camera.nearPlane, camera.farPlane);
+      ubo.proj[1][1] *= -1;
+      viewProjections[pass] = ubo.proj * ubo.view;
+    }
+
+    // Recording only walks the draws that are visible in a viewport.
+    if (m_drawBoundsDirty) {
+      updateDrawBounds();
+    }
+    m_visibleDraws.resize(viewports.size());
+    m_jobs->parallelFor(
+        viewports.size(),
+        1,
+        [&](size_t pass, size_t) {
+          std::vector<uint32_t> &visible = m_visibleDraws[pass];
+          if (m_cpuCulling) {
+            cullSpheres(m_drawBounds, Frustum(viewProjections[pass]), visible);
+          }
+          else {
+            visible.resize(drawCount);
+            std::iota(visible.begin(), visible.end(), 0u);
+          }
+        },
+        "cull"
+    );
+
+    // GPU culling has to finish before any render pass begins, so it runs for all viewports up front.
+    if (hasInstances) {
+      m_culler->record(
+          commandBuffer,
+          frame,
+          m_instances->getBuffer(frame),
+          m_instances->size(),
+          viewProjections,
+          m_indexCount,
+          m_meshRadius
+      );
+    }
+
+    for (size_t pass = 0; pass < viewports.size(); pass++) {
+      const Viewport *viewport = viewports[pass];
+      vk::Extent2D extent = viewport->swapchain->getExtent();
+      vk::Framebuffer framebuffer = viewport->swapchain->getFramebuffer(viewport->imageIndex);
 
       vk::RenderPassBeginInfo renderPassInfo = {};
       renderPassInfo.renderPass = renderPass;
-      renderPassInfo.framebuffer = swapchainFramebuffers[i];
+      renderPassInfo.framebuffer = framebuffer;
       renderPassInfo.renderArea.offset = vk::Offset2D { 0, 0 };
-      renderPassInfo.renderArea.extent = swapchainExtent;
+      renderPassInfo.renderArea.extent = extent;
 
       vk::ClearValue clearColor = {
         std::array<float, 4> {0.0f, 0.0f, 0.0f, 1.0f}
@@ -934,48 +1695,148 @@ private:
       renderPassInfo.clearValueCount = 1;
       renderPassInfo.pClearValues = &clearColor;
 
-      commandBuffers[i].beginRenderPass(renderPassInfo, vk::SubpassContents::eInline);
+      const UniformBufferObject &ubo = cameras[pass];
+      const std::vector<uint32_t> &visible = m_visibleDraws[pass];
+      size_t visibleCount = visible.size();
+
+      // The instanced draw is recorded as one more item after the visible draws, so with several recording threads it
+      // simply ends up in the last range.
+      size_t itemCount = hasInstances ? visibleCount + 1 : visibleCount;
+
+      size_t firstSlot = pass * slotCount;
+      auto recordDraws = [&](vk::CommandBuffer cmd, size_t begin, size_t end) {
+        if (begin < visibleCount) {
+          size_t last = std::min(end, visibleCount);
+          recordDrawItems(cmd, frame, extent, ubo, uniforms, firstSlot, visible.data(), begin, last);
+        }
+        if (end > visibleCount) {
+          recordInstances(cmd, frame, pass, extent, ubo, uniforms, firstSlot + drawCount);
+        }
+      };
+
+      if (m_recorder) {
+        commandBuffer.beginRenderPass(renderPassInfo, vk::SubpassContents::eSecondaryCommandBuffers);
+
+        vk::CommandBufferInheritanceInfo inheritance = {};
+        inheritance.renderPass = renderPass;
+        inheritance.subpass = 0;
+        inheritance.framebuffer = framebuffer;
+
+        const std::vector<vk::CommandBuffer> &secondaries =
+            m_recorder->record(frame, pass, inheritance, itemCount, recordDraws);
+        commandBuffer.executeCommands(secondaries);
+      }
+      else {
+        commandBuffer.beginRenderPass(renderPassInfo, vk::SubpassContents::eInline);
+        recordDraws(commandBuffer, 0, itemCount);
+      }
+
+      commandBuffer.endRenderPass();
+    }
+
+    if (timestampsSupported) {
+      commandBuffer.writeTimestamp(
+          vk::PipelineStageFlagBits::eBottomOfPipe,
+          timestampQueryPool,
+          static_cast<uint32_t>(2 * frame + 1)
+      );
+      frameTimestamped[frame] = true;
+    }
+
+    try {
+      commandBuffer.end();
+    }
+    catch (vk::SystemError) {
+      throw std::runtime_error("failed to record command buffer!");
+    }
+  }
+
+  // Records the draws listed in visible[begin, end) for one viewport. Writes each draw's uniforms into its own slot of
+  // the array allocated for this frame, starting at firstSlot, so several threads can call this for disjoint ranges at
+  // once.
+  void recordDrawItems(vk::CommandBuffer commandBuffer, size_t frame, vk::Extent2D extent, UniformBufferObject ubo,
+                       const UniformSlice &uniforms, size_t firstSlot, const uint32_t *visible, size_t begin,
+                       size_t end)
+  {
+    commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, graphicsPipeline);
+
+    // Dynamic state isn't inherited by secondary command buffers, so every range sets its own.
+    vk::Viewport viewport = { 0.0f, 0.0f, (float)extent.width, (float)extent.height, 0.0f, 1.0f };
+    vk::Rect2D scissor = { vk::Offset2D { 0, 0 }, extent };
+    commandBuffer.setViewport(0, 1, &viewport);
+    commandBuffer.setScissor(0, 1, &scissor);
 
-      commandBuffers[i].bindPipeline(vk::PipelineBindPoint::eGraphics, graphicsPipeline);
+    vk::Buffer vertexBuffers[] = { vertexBuffer };
+    vk::DeviceSize offsets[] = { 0 };
+    commandBuffer.bindVertexBuffers(0, 1, vertexBuffers, offsets);
 
-      vk::Buffer vertexBuffers[] = { vertexBuffer };
-      vk::DeviceSize offsets[] = { 0 };
-      commandBuffers[i].bindVertexBuffers(0, 1, vertexBuffers, offsets);
+    commandBuffer.bindIndexBuffer(indexBuffer, 0, m_indexType);
 
-      commandBuffers[i].bindIndexBuffer(indexBuffer, 0, vk::IndexType::eUint16);
+    vk::DeviceSize stride = m_uniforms->stride(sizeof(UniformBufferObject));
+    for (size_t i = begin; i < end; i++) {
+      ubo.model = drawItems[visible[i]].model;
+      memcpy(static_cast<uint8_t *>(uniforms.data) + (firstSlot + i) * stride, &ubo, sizeof(ubo));
+      uint32_t uniformOffset = static_cast<uint32_t>(uniforms.offset + (firstSlot + i) * stride);
 
-      commandBuffers[i].bindDescriptorSets(
+      commandBuffer.bindDescriptorSets(
           vk::PipelineBindPoint::eGraphics,
           pipelineLayout,
           0,
           1,
-          &descriptorSets[currentFrame],
-          0,
-          nullptr
+          &descriptorSets[frame],
+          1,
+          &uniformOffset
       );
 
-      commandBuffers[i].drawIndexed(static_cast<uint32_t>(indices.size()), 1, 0, 0, 0);
+      commandBuffer.drawIndexed(m_indexCount, 1, 0, 0, 0);
+    }
+  }
 
-      commandBuffers[i].endRenderPass();
+  // Records the instances of viewport pass that survived culling as a single indirect draw of the scene mesh. The
+  // instances already carry their placement, so the model matrix is the identity.
+  void recordInstances(vk::CommandBuffer commandBuffer, size_t frame, size_t pass, vk::Extent2D extent,
+                       UniformBufferObject ubo, const UniformSlice &uniforms, size_t slot)
+  {
+    commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, instancedPipeline);
 
-      try {
-        commandBuffers[i].end();
-      }
-      catch (vk::SystemError) {
-        throw std::runtime_error("failed to record command buffer!");
-      }
-    }
+    vk::Viewport viewport = { 0.0f, 0.0f, (float)extent.width, (float)extent.height, 0.0f, 1.0f };
+    vk::Rect2D scissor = { vk::Offset2D { 0, 0 }, extent };
+    commandBuffer.setViewport(0, 1, &viewport);
+    commandBuffer.setScissor(0, 1, &scissor);
+
+    vk::Buffer vertexBuffers[] = { vertexBuffer };
+    vk::DeviceSize offsets[] = { 0 };
+    commandBuffer.bindVertexBuffers(0, 1, vertexBuffers, offsets);
+
+    commandBuffer.bindIndexBuffer(indexBuffer, 0, m_indexType);
+
+    vk::DeviceSize stride = m_uniforms->stride(sizeof(UniformBufferObject));
+    ubo.model = glm::mat4(1.0f);
+    memcpy(static_cast<uint8_t *>(uniforms.data) + slot * stride, &ubo, sizeof(ubo));
+    uint32_t uniformOffset = static_cast<uint32_t>(uniforms.offset + slot * stride);
+
+    commandBuffer.bindDescriptorSets(
+        vk::PipelineBindPoint::eGraphics,
+        pipelineLayout,
+        0,
+        1,
+        &descriptorSets[frame],
+        1,
+        &uniformOffset
+    );
+
+    // Binds binding 1 to the viewport's visible instances.
+    m_culler->draw(commandBuffer, frame, pass);
   }
 
   void createSyncObjects()
   {
-    imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-    renderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-    inFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
+    renderFinishedSemaphores.resize(m_framesInFlight);
+    inFlightFences.resize(m_framesInFlight);
+    slotFrames.assign(m_framesInFlight, 0);
 
     try {
-      for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-        imageAvailableSemaphores[i] = device->createSemaphore({});
+      for (size_t i = 0; i < m_framesInFlight; i++) {
         renderFinishedSemaphores[i] = device->createSemaphore({});
         inFlightFences[i] = device->createFence({ vk::FenceCreateFlagBits::eSignaled });
       }
@@ -985,163 +1846,170 @@ private:
     }
   }
 
+  // Renders every viewport into one command buffer, submits it once and presents all windows with a single
+  // presentKHR. A headless renderer skips acquire and present: the offscreen image for this frame is the one owned by
+  // currentFrame, so the fence we just waited on is all the synchronization it needs.
   void drawFrame()
   {
+    std::lock_guard<std::mutex> lock(m_frameMutex);
+
+    frameTimer.tick();
     if (device->waitForFences(1, &inFlightFences[currentFrame], VK_TRUE, std::numeric_limits<uint64_t>::max()) !=
         vk::Result::eSuccess) {
       throw std::runtime_error("waitForFences timed out!");
     }
 
-    uint32_t imageIndex;
-    try {
-      vk::ResultValue result = device->acquireNextImageKHR(
-          swapchain,
-          std::numeric_limits<uint64_t>::max(),
-          imageAvailableSemaphores[currentFrame],
-          nullptr
-      );
-      imageIndex = result.value;
+    m_lastSample.gpuFrame = readGpuFrameTime(currentFrame);
+    collectRetired();
+    updatePipelines();
+    applyViewportUpdates();
+    updateDisplayRate();
+
+    std::vector<Viewport *> viewports;
+    for (Viewport *viewport : m_viewports) {
+      if (acquireImage(viewport)) {
+        viewports.push_back(viewport);
+      }
     }
+    m_lastSample.acquireWait = frameTimer.tock().count();
 
-    catch (vk::OutOfDateKHRError) {
-      recreateSwapchain();
+    if (viewports.empty()) {
+      // Every window is minimized or just went out of date. Nothing to render into, try again a little later.
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      m_needsAnotherFrame = true;
       return;
     }
-    catch (vk::SystemError) {
-      throw std::runtime_error("failed to acquire swap chain image!");
-    }
 
-    updateUniformBuffer(static_cast<uint32_t>(currentFrame));
+    updateScene();
+    recordCommandBuffer(currentFrame, viewports);
+
+    UploadSubmission upload = m_uploads->flush(currentFrame);
+
+    std::vector<vk::Semaphore> waitSemaphores;
+    std::vector<vk::PipelineStageFlags> waitStages;
+    std::vector<vk::SwapchainKHR> swapchains;
+    std::vector<uint32_t> imageIndices;
+    for (Viewport *viewport : viewports) {
+      if (!viewport->swapchain->isOffscreen()) {
+        waitSemaphores.push_back(viewport->imageAvailableSemaphores[currentFrame]);
+        waitStages.push_back(vk::PipelineStageFlagBits::eColorAttachmentOutput);
+        swapchains.push_back(*viewport->swapchain);
+        imageIndices.push_back(viewport->imageIndex);
+      }
+    }
+    if (upload.semaphore) {
+      waitSemaphores.push_back(upload.semaphore);
+      waitStages.push_back(upload.waitStage);
+    }
 
     vk::SubmitInfo submitInfo = {};
+    submitInfo.waitSemaphoreCount = static_cast<uint32_t>(waitSemaphores.size());
+    submitInfo.pWaitSemaphores = waitSemaphores.data();
+    submitInfo.pWaitDstStageMask = waitStages.data();
 
-    vk::Semaphore waitSemaphores[] = { imageAvailableSemaphores[currentFrame] };
-    vk::PipelineStageFlags waitStages[] = { vk::PipelineStageFlagBits::eColorAttachmentOutput };
-    submitInfo.waitSemaphoreCount = 1;
-    submitInfo.pWaitSemaphores = waitSemaphores;
-    submitInfo.pWaitDstStageMask = waitStages;
-
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &commandBuffers[imageIndex];
+    vk::CommandBuffer submitCommandBuffers[] = { upload.acquireCommands, frameCommandBuffers[currentFrame] };
+    submitInfo.commandBufferCount = upload.acquireCommands ? 2 : 1;
+    submitInfo.pCommandBuffers = upload.acquireCommands ? submitCommandBuffers : &frameCommandBuffers[currentFrame];
 
+    // Nothing waits for it when nothing is presented.
     vk::Semaphore signalSemaphores[] = { renderFinishedSemaphores[currentFrame] };
-    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.signalSemaphoreCount = swapchains.empty() ? 0 : 1;
     submitInfo.pSignalSemaphores = signalSemaphores;
 
+    m_lastSample.cpuRecord = frameTimer.tock().count();
+
     if (device->resetFences(1, &inFlightFences[currentFrame]) != vk::Result::eSuccess) {
       throw std::runtime_error("failed to reset fences!");
     }
 
+    // When nothing is presented (headless) this only covers the submit call itself.
+    Timing<std::chrono::duration<double, std::ratio<1>>> submitTimer;
     try {
       m_device->graphicsQueue.submit(submitInfo, inFlightFences[currentFrame]);
     }
     catch (vk::SystemError) {
       throw std::runtime_error("failed to submit draw command buffer!");
     }
-
-    vk::PresentInfoKHR presentInfo = {};
-    presentInfo.waitSemaphoreCount = 1;
-    presentInfo.pWaitSemaphores = signalSemaphores;
-
-    vk::SwapchainKHR swapchains[] = { swapchain };
-    presentInfo.swapchainCount = 1;
-    presentInfo.pSwapchains = swapchains;
-    presentInfo.pImageIndices = &imageIndex;
-
-    vk::Result resultPresent;
-    try {
-      resultPresent = m_device->presentQueue.presentKHR(presentInfo);
-    }
-    catch (vk::OutOfDateKHRError) {
-      resultPresent = vk::Result::eErrorOutOfDateKHR;
-    }
-    catch (vk::SystemError) {
-      throw std::runtime_error("failed to present swap chain image!");
-    }
-
-    if (resultPresent == vk::Result::eErrorOutOfDateKHR || resultPresent == vk::Result::eSuboptimalKHR ||
-        m_surfaceInfo.isResized) {
-      m_surfaceInfo.isResized = false;
-      recreateSwapchain();
-      return;
-    }
-
-    currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
-  }
-
-  vk::UniqueShaderModule createShaderModule(const std::vector<char> &code)
-  {
-    try {
-      return device->createShaderModuleUnique(
-          { vk::ShaderModuleCreateFlags(), code.size(), reinterpret_cast<const uint32_t *>(code.data()) }
-      );
-    }
-    catch (vk::SystemError) {
-      throw std::runtime_error("failed to create shader module!");
-    }
-  }
-
-  vk::SurfaceFormatKHR chooseSwapSurfaceFormat(const std::vector<vk::SurfaceFormatKHR> &availableFormats)
-  {
-    if (availableFormats.size() == 1 && availableFormats[0].format == vk::Format::eUndefined) {
-      return { vk::Format::eB8G8R8A8Unorm, vk::ColorSpaceKHR::eSrgbNonlinear };
-    }
-
-    for (const auto &availableFormat : availableFormats) {
-      if (availableFormat.format == vk::Format::eB8G8R8A8Unorm &&
-          availableFormat.colorSpace == vk::ColorSpaceKHR::eSrgbNonlinear) {
-        return availableFormat;
+    slotFrames[currentFrame] = frameNumber++;
+
+    if (!swapchains.empty()) {
+      std::vector<vk::Result> results(swapchains.size());
+
+      vk::PresentInfoKHR presentInfo = {};
+      presentInfo.waitSemaphoreCount = 1;
+      presentInfo.pWaitSemaphores = signalSemaphores;
+      presentInfo.swapchainCount = static_cast<uint32_t>(swapchains.size());
+      presentInfo.pSwapchains = swapchains.data();
+      presentInfo.pImageIndices = imageIndices.data();
+      presentInfo.pResults = results.data();
+
+      // The pointer overload reports out of date swapchains through the result instead of throwing.
+      vk::Result resultPresent = m_device->presentQueue.presentKHR(&presentInfo);
+      if (resultPresent != vk::Result::eSuccess && resultPresent != vk::Result::eSuboptimalKHR &&
+          resultPresent != vk::Result::eErrorOutOfDateKHR) {
+        throw std::runtime_error("failed to present swap chain image!");
       }
-    }
-
-    return availableFormats[0];
-  }
-
-  vk::PresentModeKHR chooseSwapPresentMode(const std::vector<vk::PresentModeKHR> availablePresentModes)
-  {
-    vk::PresentModeKHR bestMode = vk::PresentModeKHR::eFifo;
 
-    for (const auto &availablePresentMode : availablePresentModes) {
-      if (availablePresentMode == vk::PresentModeKHR::eMailbox) {
-        return availablePresentMode;
-      }
-      else if (availablePresentMode == vk::PresentModeKHR::eImmediate) {
-        bestMode = availablePresentMode;
+      // Each swapchain has its own result. Those that need it are recreated at the start of the next frame.
+      size_t presented = 0;
+      for (Viewport *viewport : viewports) {
+        if (viewport->swapchain->isOffscreen()) {
+          continue;
+        }
+        vk::Result result = results[presented++];
+        if (result == vk::Result::eErrorOutOfDateKHR || result == vk::Result::eSuboptimalKHR) {
+          viewport->isResized = true;
+          m_needsAnotherFrame = true;
+        }
       }
     }
+    m_lastSample.submitToPresent = submitTimer.tock().count();
 
-    return bestMode;
+    currentFrame = (currentFrame + 1) % m_framesInFlight;
   }
 
-  vk::Extent2D chooseSwapExtent(const vk::SurfaceCapabilitiesKHR &capabilities)
+  // Brings the viewport's swapchain up to date and picks the image it renders into this frame. This is the only place
+  // swapchains are recreated, so each is recreated at most once per frame; problems reported by acquire and present
+  // just set isResized. Returns false if the viewport can't render this frame (minimized or out of date).
+  bool acquireImage(Viewport *viewport)
   {
-    if (capabilities.currentExtent.width != std::numeric_limits<uint32_t>::max()) {
-      return capabilities.currentExtent;
+    if (viewport->isResized && !recreateSwapchain(viewport)) {
+      return false;
     }
-    else {
-      int width, height;
-      width = m_surfaceInfo.width;
-      height = m_surfaceInfo.height;
 
-      vk::Extent2D actualExtent = { static_cast<uint32_t>(width), static_cast<uint32_t>(height) };
+    if (viewport->swapchain->isOffscreen()) {
+      viewport->imageIndex = static_cast<uint32_t>(currentFrame);
+      return true;
+    }
 
-      actualExtent.width =
-          std::max(capabilities.minImageExtent.width, std::min(capabilities.maxImageExtent.width, actualExtent.width));
-      actualExtent.height = std::max(
-          capabilities.minImageExtent.height,
-          std::min(capabilities.maxImageExtent.height, actualExtent.height)
+    try {
+      vk::ResultValue result = device->acquireNextImageKHR(
+          *viewport->swapchain,
+          std::numeric_limits<uint64_t>::max(),
+          viewport->imageAvailableSemaphores[currentFrame],
+          nullptr
       );
-
-      return actualExtent;
+      viewport->imageIndex = result.value;
     }
+    catch (vk::OutOfDateKHRError) {
+      viewport->isResized = true;
+      m_needsAnotherFrame = true;
+      return false;
+    }
+    catch (vk::SystemError) {
+      throw std::runtime_error("failed to acquire swap chain image!");
+    }
+    return true;
   }
 
-
   std::vector<const char *> getRequiredExtensions()
   {
 
     // std::vector<const char *> extensions = m_surfaceInfo.glfwExtensions;
-    std::vector<const char *> extensions = { "VK_KHR_surface", "VK_KHR_win32_surface" };
+    std::vector<const char *> extensions;
+    if (!m_headless) {
+      extensions = { "VK_KHR_surface", "VK_KHR_win32_surface" };
+    }
 
     if (vdb::enableValidationLayers) {
       extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
@@ -1149,24 +2017,4 @@ private:
 
     return extensions;
   }
-
-
-  static std::vector<char> readFile(const std::string &filename)
-  {
-    std::ifstream file(filename, std::ios::ate | std::ios::binary);
-
-    if (!file.is_open()) {
-      throw std::runtime_error("failed to open file!");
-    }
-
-    size_t fileSize = (size_t)file.tellg();
-    std::vector<char> buffer(fileSize);
-
-    file.seekg(0);
-    file.read(buffer.data(), fileSize);
-
-    file.close();
-
-    return buffer;
-  }
 };
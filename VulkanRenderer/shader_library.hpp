@@ -0,0 +1,135 @@
+#pragma once
+#ifndef SHADER_LIBRARY_HH
+#define SHADER_LIBRARY_HH
+
+#include <vulkan/vulkan.hpp>
+
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "device.hpp"
+#include "hash.hpp"
+#include "mapped_file.hpp"
+#include "shader_registry.hpp"
+
+// Owns every vk::ShaderModule for the lifetime of the device. Modules are keyed by a hash of their SPIR-V, so two
+// files with the same contents share a module and a pipeline rebuild never creates one again.
+//
+// Shaders compiled into the binary are used by default, so loading them touches no files at all. Files on disk take
+// over when asked for explicitly (hot reload, or a shader that wasn't embedded). They are memory mapped rather than
+// read into a buffer, and a file whose size and modification time haven't changed since it was last loaded isn't even
+// opened again. Thread safe, the shader watcher loads from its own thread.
+class ShaderLibrary {
+public:
+  ShaderLibrary(Device *device_) : device(device_) {}
+
+  ~ShaderLibrary()
+  {
+    for (auto &[key, module] : modules) {
+      (*device)->destroyShaderModule(module);
+    }
+  }
+
+  // The embedded copy of path if there is one and preferFile isn't set, otherwise the file itself.
+  vk::ShaderModule load(const std::string &path, bool preferFile = false)
+  {
+    if (!preferFile) {
+      if (const EmbeddedShader *embedded = findEmbeddedShader(path)) {
+        return loadEmbedded(*embedded);
+      }
+    }
+    return loadFile(path);
+  }
+
+  vk::ShaderModule loadFile(const std::string &path)
+  {
+    std::error_code error;
+    auto writeTime = std::filesystem::last_write_time(path, error);
+    auto fileSize = error ? 0 : std::filesystem::file_size(path, error);
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto known = files.find(path);
+    if (!error && known != files.end() && known->second.writeTime == writeTime && known->second.size == fileSize) {
+      return modules.at(known->second.key);
+    }
+
+    MappedFile file(path);
+    if (file.size() == 0 || file.size() % 4 != 0) {
+      throw std::runtime_error("invalid SPIR-V file " + path + "!");
+    }
+
+    ModuleKey key { fnv1a(file.data(), file.size()), file.size() };
+    files[path] = { writeTime, fileSize, key };
+
+    // The mapping is page aligned, so the words can be passed straight through.
+    return findOrCreate(key, reinterpret_cast<const uint32_t *>(file.data()));
+  }
+
+  size_t getModuleCount()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return modules.size();
+  }
+
+private:
+  struct ModuleKey {
+    uint64_t hash;
+    size_t size;
+
+    bool operator<(const ModuleKey &other) const
+    {
+      return hash != other.hash ? hash < other.hash : size < other.size;
+    }
+  };
+
+  struct FileState {
+    std::filesystem::file_time_type writeTime;
+    uintmax_t size;
+    ModuleKey key;
+  };
+
+  vk::ShaderModule loadEmbedded(const EmbeddedShader &shader)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto known = embedded.find(&shader);
+    if (known != embedded.end()) {
+      return modules.at(known->second);
+    }
+
+    ModuleKey key { fnv1a(shader.code, shader.size), shader.size };
+    embedded[&shader] = key;
+    return findOrCreate(key, shader.code);
+  }
+
+  // Called with the mutex held.
+  vk::ShaderModule findOrCreate(const ModuleKey &key, const uint32_t *code)
+  {
+    auto existing = modules.find(key);
+    if (existing != modules.end()) {
+      return existing->second;
+    }
+
+    vk::ShaderModule module;
+    try {
+      module = (*device)->createShaderModule({ vk::ShaderModuleCreateFlags(), key.size, code });
+    }
+    catch (vk::SystemError) {
+      throw std::runtime_error("failed to create shader module!");
+    }
+    modules[key] = module;
+    return module;
+  }
+
+  Device *device;
+  std::map<ModuleKey, vk::ShaderModule> modules;
+  std::unordered_map<std::string, FileState> files;
+  std::unordered_map<const EmbeddedShader *, ModuleKey> embedded;
+  std::mutex mutex;
+};
+
+#endif
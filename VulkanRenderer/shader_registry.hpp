@@ -0,0 +1,38 @@
+#pragma once
+#ifndef SHADER_REGISTRY_HH
+#define SHADER_REGISTRY_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+// SPIR-V compiled into the binary. shaders/embedded_shaders.h is generated from shaders/*.spv by the pre-build step
+// (shaders/embed.bat, or shaders/embed.sh elsewhere) and is not checked in.
+struct EmbeddedShader {
+  const char *name; // File name of the .spv it was generated from
+  const uint32_t *code;
+  size_t size; // In bytes
+};
+
+#if __has_include("shaders/embedded_shaders.h")
+#include "shaders/embedded_shaders.h"
+#define HAS_EMBEDDED_SHADERS
+#endif
+
+// Looks a shader up by the file name part of path, so "shaders/vert.spv" finds the embedded "vert.spv". Returns
+// nullptr if it wasn't embedded.
+inline const EmbeddedShader *findEmbeddedShader(const std::string &path)
+{
+#ifdef HAS_EMBEDDED_SHADERS
+  std::string name = std::filesystem::path(path).filename().string();
+  for (const EmbeddedShader &shader : embeddedShaders) {
+    if (name == shader.name) {
+      return &shader;
+    }
+  }
+#endif
+  return nullptr;
+}
+
+#endif
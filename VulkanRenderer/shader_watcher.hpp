@@ -0,0 +1,236 @@
+#pragma once
+#ifndef SHADER_WATCHER_HH
+#define SHADER_WATCHER_HH
+
+#include <vulkan/vulkan.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "debugging.hpp"
+#include "device.hpp"
+
+// A GLSL source and the SPIR-V file the pipeline is built from.
+struct WatchedShader {
+  std::string source;
+  std::string spirv;
+};
+
+// Polls the shader files of a set of pipelines on a worker thread. When a GLSL source changes it is compiled with
+// glslc; when any SPIR-V changes (freshly compiled or dropped in from outside) every pipeline built from it is rebuilt,
+// still on the worker thread. Files shared between pipelines are watched and compiled once. The render thread picks
+// new pipelines up with takePipeline at a frame boundary and never waits for any of this.
+//
+// A failed compile or pipeline build is logged and otherwise ignored, so the last good pipeline stays in use.
+class ShaderWatcher {
+public:
+  // Builds a pipeline from the current SPIR-V files. Throws on failure.
+  using Rebuild = std::function<vk::Pipeline()>;
+  // Called on the worker thread once new pipelines are ready to be taken.
+  using Ready = std::function<void()>;
+
+  // A pipeline and the shaders it is built from. A shader without a source is only watched for new SPIR-V, unless
+  // another pipeline lists its source.
+  struct Pipeline {
+    std::vector<WatchedShader> shaders;
+    Rebuild rebuild;
+  };
+
+  ShaderWatcher(Device *device_, std::vector<Pipeline> pipelines_, Ready onReady_ = nullptr,
+                std::chrono::milliseconds interval_ = std::chrono::milliseconds(250))
+      : device(device_), pipelines(std::move(pipelines_)), onReady(std::move(onReady_)), interval(interval_)
+  {
+    for (const Pipeline &pipeline : pipelines) {
+      std::vector<size_t> used;
+      for (const WatchedShader &shader : pipeline.shaders) {
+        used.push_back(addShader(shader));
+      }
+      uses.push_back(std::move(used));
+    }
+    ready.resize(pipelines.size());
+
+    // Whatever is on disk now is what the current pipelines were built from.
+    for (auto &shader : shaders) {
+      sourceTimes.push_back(writeTime(shader.source));
+      spirvTimes.push_back(writeTime(shader.spirv));
+    }
+
+    thread = std::thread([this]() { watchLoop(); });
+  }
+
+  ~ShaderWatcher()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    thread.join();
+
+    discardPending();
+  }
+
+  // Render thread. Returns a newly built pipeline for pipelines[index] exactly once, or a null handle. The caller owns
+  // it from then on and is responsible for retiring the pipeline it replaces.
+  vk::Pipeline takePipeline(size_t index)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    vk::Pipeline pipeline = ready[index];
+    ready[index] = nullptr;
+    return pipeline;
+  }
+
+  // Drops built pipelines that haven't been picked up yet, e.g. because the render pass they were built for is gone.
+  void discardPending()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (vk::Pipeline &pipeline : ready) {
+      if (pipeline) {
+        (*device)->destroyPipeline(pipeline);
+        pipeline = nullptr;
+      }
+    }
+  }
+
+private:
+  Device *device;
+  std::vector<Pipeline> pipelines;
+  std::vector<std::vector<size_t>> uses; // Per pipeline, indices into shaders
+  Ready onReady;
+  std::chrono::milliseconds interval;
+
+  std::vector<WatchedShader> shaders; // Every file once
+  std::vector<std::filesystem::file_time_type> sourceTimes;
+  std::vector<std::filesystem::file_time_type> spirvTimes;
+
+  std::thread thread;
+  std::mutex mutex;
+  std::condition_variable wake;
+  bool stopping = false;
+  std::vector<vk::Pipeline> ready; // Per pipeline
+
+  size_t addShader(const WatchedShader &shader)
+  {
+    for (size_t i = 0; i < shaders.size(); i++) {
+      if (shaders[i].spirv == shader.spirv) {
+        if (shaders[i].source.empty()) {
+          shaders[i].source = shader.source;
+        }
+        return i;
+      }
+    }
+    shaders.push_back(shader);
+    return shaders.size() - 1;
+  }
+
+  static std::filesystem::file_time_type writeTime(const std::string &path)
+  {
+    std::error_code error;
+    auto time = std::filesystem::last_write_time(path, error);
+    return error ? std::filesystem::file_time_type::min() : time;
+  }
+
+  static std::string glslc()
+  {
+    const char *sdk = std::getenv("VULKAN_SDK");
+    return sdk ? (std::filesystem::path(sdk) / "Bin" / "glslc").string() : "glslc";
+  }
+
+  // Compiles into a temporary file first, so the SPIR-V file is never seen half written and a failed compile leaves
+  // the old one alone.
+  static bool compile(const WatchedShader &shader)
+  {
+    std::string tempPath = shader.spirv + ".tmp";
+    std::string command = "\"" + glslc() + "\" \"" + shader.source + "\" -o \"" + tempPath + "\"";
+#ifdef _WIN32
+    // cmd /c strips the outermost pair of quotes.
+    command = "\"" + command + "\"";
+#endif
+    if (std::system(command.c_str()) != 0) {
+      vdb::debugOutput("Shader compilation failed: " + shader.source);
+      return false;
+    }
+
+    std::error_code error;
+    std::filesystem::rename(tempPath, shader.spirv, error);
+    if (error) {
+      vdb::debugOutput("Could not replace " + shader.spirv);
+      return false;
+    }
+    return true;
+  }
+
+  void watchLoop()
+  {
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (wake.wait_for(lock, interval, [this]() { return stopping; })) {
+          return;
+        }
+      }
+
+      for (size_t i = 0; i < shaders.size(); i++) {
+        auto sourceTime = writeTime(shaders[i].source);
+        if (sourceTime != sourceTimes[i]) {
+          sourceTimes[i] = sourceTime;
+          vdb::debugOutput("Recompiling " + shaders[i].source);
+          compile(shaders[i]);
+        }
+      }
+
+      std::vector<bool> changed(shaders.size(), false);
+      for (size_t i = 0; i < shaders.size(); i++) {
+        auto spirvTime = writeTime(shaders[i].spirv);
+        if (spirvTime != spirvTimes[i]) {
+          spirvTimes[i] = spirvTime;
+          changed[i] = true;
+        }
+      }
+
+      bool rebuilt = false;
+      for (size_t p = 0; p < pipelines.size(); p++) {
+        if (std::none_of(uses[p].begin(), uses[p].end(), [&](size_t i) { return changed[i]; })) {
+          continue;
+        }
+
+        vk::Pipeline pipeline;
+        try {
+          pipeline = pipelines[p].rebuild();
+        }
+        catch (std::exception &e) {
+          vdb::debugOutput(std::string("Shader reload failed, keeping the old pipeline: ") + e.what());
+          continue;
+        }
+
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          if (ready[p]) {
+            // Never picked up, superseded by this one.
+            (*device)->destroyPipeline(ready[p]);
+          }
+          ready[p] = pipeline;
+        }
+        rebuilt = true;
+      }
+      if (!rebuilt) {
+        continue;
+      }
+
+      vdb::debugOutput("Shaders reloaded.");
+      if (onReady) {
+        onReady();
+      }
+    }
+  }
+};
+
+#endif
@@ -1,2 +1,4 @@
 glslangValidator.exe -V source\shader.vert
 glslangValidator.exe -V source\shader.frag
+glslangValidator.exe -V source\instanced.vert -o instanced_vert.spv
+glslangValidator.exe -V source\cull.comp -o cull_comp.spv
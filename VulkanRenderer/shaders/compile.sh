@@ -1,4 +1,7 @@
 glslc source/shader.vert -o vert.spv
 glslc source/shader.frag -o frag.spv
+glslc source/instanced.vert -o instanced_vert.spv
+glslc source/cull.comp -o cull_comp.spv
 glslc source/texture_shader.vert -o texture_vert.spv
 glslc source/texture_shader.frag -o texture_frag.spv
+sh embed.sh
@@ -0,0 +1 @@
+powershell -NoProfile -ExecutionPolicy Bypass -File embed.ps1
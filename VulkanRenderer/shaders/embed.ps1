@@ -0,0 +1,40 @@
+# Turns every *.spv next to this script into a uint32_t array in embedded_shaders.h (see shader_registry.hpp).
+# The header is only rewritten when its contents change, so unchanged shaders don't trigger a rebuild.
+$ErrorActionPreference = 'Stop'
+
+$out = Join-Path $PSScriptRoot 'embedded_shaders.h'
+$files = Get-ChildItem -Path $PSScriptRoot -Filter *.spv | Sort-Object Name
+
+$sb = New-Object System.Text.StringBuilder
+[void]$sb.Append("// Generated by embed.ps1 from shaders/*.spv. Do not edit.`n")
+[void]$sb.Append("#pragma once`n`n")
+
+foreach ($f in $files) {
+  $id = 'spirv_' + ($f.Name -replace '[^A-Za-z0-9]', '_')
+  $bytes = [System.IO.File]::ReadAllBytes($f.FullName)
+  if ($bytes.Length % 4 -ne 0) {
+    throw "$($f.Name) is not a whole number of SPIR-V words"
+  }
+
+  [void]$sb.Append("constexpr uint32_t $id[] = {`n")
+  for ($i = 0; $i -lt $bytes.Length; $i += 16) {
+    $words = @()
+    for ($j = $i; $j -lt [Math]::Min($i + 16, $bytes.Length); $j += 4) {
+      $words += '0x{0:x8}u,' -f [BitConverter]::ToUInt32($bytes, $j)
+    }
+    [void]$sb.Append('  ' + ($words -join ' ') + "`n")
+  }
+  [void]$sb.Append("};`n")
+}
+
+[void]$sb.Append("`nconstexpr EmbeddedShader embeddedShaders[] = {`n")
+foreach ($f in $files) {
+  $id = 'spirv_' + ($f.Name -replace '[^A-Za-z0-9]', '_')
+  [void]$sb.Append("  {`"$($f.Name)`", $id, sizeof($id)},`n")
+}
+[void]$sb.Append("};`n")
+
+$text = $sb.ToString()
+if (!(Test-Path $out) -or [System.IO.File]::ReadAllText($out) -ne $text) {
+  [System.IO.File]::WriteAllText($out, $text)
+}
@@ -0,0 +1,32 @@
+#!/bin/sh
+# Turns every *.spv next to this script into a uint32_t array in embedded_shaders.h (see shader_registry.hpp).
+# The header is only rewritten when its contents change, so unchanged shaders don't trigger a rebuild.
+cd "$(dirname "$0")"
+
+out=embedded_shaders.h
+tmp=$out.tmp
+
+{
+  echo "// Generated by embed.sh from shaders/*.spv. Do not edit."
+  echo "#pragma once"
+  echo
+  for f in *.spv; do
+    id=spirv_$(echo "$f" | sed 's/[^A-Za-z0-9]/_/g')
+    echo "constexpr uint32_t $id[] = {"
+    od -An -v -tx4 "$f" | awk '{ line = " "; for (i = 1; i <= NF; i++) line = line " 0x" $i "u,"; print line }'
+    echo "};"
+  done
+  echo
+  echo "constexpr EmbeddedShader embeddedShaders[] = {"
+  for f in *.spv; do
+    id=spirv_$(echo "$f" | sed 's/[^A-Za-z0-9]/_/g')
+    echo "  {\"$f\", $id, sizeof($id)},"
+  done
+  echo "};"
+} > "$tmp"
+
+if cmp -s "$tmp" "$out"; then
+  rm "$tmp"
+else
+  mv "$tmp" "$out"
+fi
@@ -0,0 +1,33 @@
+#version 450
+
+layout(binding = 0) uniform UniformBufferObject {
+	mat4 model;
+	mat4 view;
+	mat4 proj;
+} ubo;
+
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec3 inColor;
+
+// Per instance, same locations as in texture_shader.vert.
+layout(location = 3) in vec3 instancePos;
+layout(location = 4) in vec3 instanceRot;
+layout(location = 5) in float instanceScale;
+
+layout(location = 0) out vec3 fragColor;
+
+// Euler angles in radians, applied around x, then y, then z.
+mat3 rotation(vec3 angles) {
+	vec3 c = cos(angles);
+	vec3 s = sin(angles);
+	mat3 rx = mat3(1.0, 0.0, 0.0, 0.0, c.x, s.x, 0.0, -s.x, c.x);
+	mat3 ry = mat3(c.y, 0.0, -s.y, 0.0, 1.0, 0.0, s.y, 0.0, c.y);
+	mat3 rz = mat3(c.z, s.z, 0.0, -s.z, c.z, 0.0, 0.0, 0.0, 1.0);
+	return rz * ry * rx;
+}
+
+void main() {
+	vec3 local = rotation(instanceRot) * vec3(inPosition * instanceScale, 0.0);
+	gl_Position = ubo.proj * ubo.view * ubo.model * vec4(instancePos + local, 1.0);
+	fragColor = inColor;
+}
@@ -0,0 +1,53 @@
+#pragma once
+#ifndef SIMD_HH
+#define SIMD_HH
+
+// Which SIMD instruction sets the hot loops (culling, transforms) may use. SSE2 is part of x86-64 and NEON of
+// AArch64, so those need no runtime check; wider extensions do.
+#if defined(_M_X64) || defined(__x86_64__)
+#define SIMD_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#elif defined(_M_ARM64) || defined(__aarch64__)
+#define SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+
+// GCC and Clang only emit AVX2 and FMA in functions that ask for them; MSVC always can. Callers check the CPU with
+// cpuHasAvx2 before taking such a path, so the binary still runs on plain SSE2 machines.
+#if defined(SIMD_X86) && (defined(__GNUC__) || defined(__clang__))
+#define SIMD_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#else
+#define SIMD_TARGET_AVX2
+#endif
+
+#ifdef SIMD_X86
+inline bool cpuHasAvx2()
+{
+  static const bool hasAvx2 = []() {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+      return false;
+    }
+    __cpuid(info, 1);
+    bool osxsave = info[2] & (1 << 27), avx = info[2] & (1 << 28), fma = info[2] & (1 << 12);
+    // The OS has to save the upper halves of the ymm registers too.
+    if (!osxsave || !avx || !fma || (_xgetbv(0) & 6) != 6) {
+      return false;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+  }();
+  return hasAvx2;
+}
+#endif
+
+#endif
@@ -0,0 +1,159 @@
+#pragma once
+#ifndef STAGING_HH
+#define STAGING_HH
+
+#include <vulkan/vulkan.hpp>
+
+#include <algorithm>
+#include <deque>
+#include <mutex>
+
+#include "allocator.hpp"
+#include "device.hpp"
+
+// A slice of the staging ring. data points straight into persistently mapped, host coherent memory.
+struct StagingRegion {
+  vk::Buffer buffer;
+  vk::DeviceSize offset = 0;
+  vk::DeviceSize size = 0;
+  void *data = nullptr;
+
+  uint64_t id = 0; // Position in the ring's allocation order
+
+  explicit operator bool() const { return data != nullptr; }
+};
+
+// One big persistently mapped staging buffer used as a ring. Producers on any thread reserve a region and memcpy into
+// it; no Vulkan objects are created per upload. Once the copy out of a region has been submitted, retire tags it with
+// a submission epoch, and complete(epoch) gives the space back when the fence of that submission has signaled.
+//
+// Space is reclaimed strictly in allocation order, so a region that is reserved but never retired holds up the ring.
+// Every reserved region must be handed to the upload service.
+class StagingRing {
+public:
+  StagingRing(Device *device_, MemoryAllocator *allocator_, vk::DeviceSize capacity_)
+      : device(device_), allocator(allocator_), capacity(capacity_)
+  {
+    vk::BufferCreateInfo bufferInfo = {};
+    bufferInfo.size = capacity;
+    bufferInfo.usage = vk::BufferUsageFlagBits::eTransferSrc;
+    bufferInfo.sharingMode = vk::SharingMode::eExclusive;
+
+    try {
+      buffer = (*device)->createBuffer(bufferInfo);
+    }
+    catch (vk::SystemError) {
+      throw std::runtime_error("failed to create staging ring buffer!");
+    }
+
+    memory = allocator->allocate(
+        (*device)->getBufferMemoryRequirements(buffer),
+        vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent
+    );
+    allocator->bindBuffer(buffer, memory);
+    mapped = static_cast<uint8_t *>(memory.mapped);
+  }
+
+  ~StagingRing()
+  {
+    (*device)->destroyBuffer(buffer);
+    allocator->free(memory);
+  }
+
+  vk::DeviceSize getCapacity() const { return capacity; }
+
+  // Returns an empty region if there is not enough free space right now.
+  StagingRegion reserve(vk::DeviceSize size, vk::DeviceSize alignment = 16)
+  {
+    if (size == 0 || size > capacity) {
+      return {};
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    uint64_t tail = reservations.empty() ? head : reservations.front().begin;
+    uint64_t start = alignUp(head, alignment);
+    if (start % capacity + size > capacity) {
+      // Doesn't fit before the end of the buffer. Skip the remainder, it belongs to this reservation until reclaimed.
+      start += capacity - start % capacity;
+    }
+    if (start + size - tail > capacity) {
+      return {};
+    }
+
+    reservations.push_back({ head, start + size, NOT_RETIRED });
+    head = start + size;
+
+    StagingRegion region;
+    region.buffer = buffer;
+    region.offset = start % capacity;
+    region.size = size;
+    region.data = mapped + region.offset;
+    region.id = reservations.back().begin;
+    return region;
+  }
+
+  // The copy out of region has been submitted as part of epoch.
+  void retire(const StagingRegion &region, uint64_t epoch)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    find(region.id).epoch = epoch;
+  }
+
+  // Everything submitted with epoch is done on the GPU.
+  void complete(uint64_t epoch)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto &reservation : reservations) {
+      if (reservation.epoch == epoch) {
+        reservation.epoch = DONE;
+      }
+    }
+    while (!reservations.empty() && reservations.front().epoch == DONE) {
+      reservations.pop_front();
+    }
+  }
+
+private:
+  static const uint64_t NOT_RETIRED = ~0ull;
+  static const uint64_t DONE = ~0ull - 1;
+
+  struct Reservation {
+    uint64_t begin; // Monotonic positions; the buffer offset is position % capacity
+    uint64_t end;
+    uint64_t epoch;
+  };
+
+  Device *device;
+  MemoryAllocator *allocator;
+  vk::DeviceSize capacity;
+
+  vk::Buffer buffer;
+  Allocation memory;
+  uint8_t *mapped = nullptr;
+
+  uint64_t head = 0;
+  std::deque<Reservation> reservations; // Sorted by begin
+  std::mutex mutex;
+
+  static uint64_t alignUp(uint64_t value, uint64_t alignment)
+  {
+    return alignment > 1 ? (value + alignment - 1) / alignment * alignment : value;
+  }
+
+  Reservation &find(uint64_t id)
+  {
+    auto it = std::lower_bound(
+        reservations.begin(),
+        reservations.end(),
+        id,
+        [](const Reservation &r, uint64_t value) { return r.begin < value; }
+    );
+    if (it == reservations.end() || it->begin != id) {
+      throw std::runtime_error("unknown staging ring region!");
+    }
+    return *it;
+  }
+};
+
+#endif
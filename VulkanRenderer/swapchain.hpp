@@ -3,70 +3,88 @@
 #define SWAPCHAIN_HH
 
 #define VK_USE_PLATFORM_WIN32_KHR
+#include "allocator.hpp"
 #include "device.hpp"
 #include <vulkan/vulkan.hpp>
 
-#include "windef.h" // For HWND
-
-struct ViewportInfo {
-  // int width;
-  // int height;
-  bool isResized = false;
-  HWND hwnd;
-  HINSTANCE hinstance;
-  vk::SurfaceKHR surface;
-  vk::SurfaceFormatKHR surfaceFormat;
-  vk::Extent2D surfaceExtent;
-  // Swapchain swapchain;
-
-  std::vector<const char *> extensions;
-};
-
-struct SurfaceSupportDetails {
-  vk::SurfaceCapabilitiesKHR capabilities;
-  std::vector<vk::SurfaceFormatKHR> formats;
-  std::vector<vk::PresentModeKHR> presentModes;
-};
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <vector>
 
+// The images one viewport renders into, with their views and framebuffers. Either a real swapchain on a window surface
+// or, for a headless renderer, a set of offscreen images with one image per frame in flight.
+//
+// Every viewport of a renderer shares its render pass, so all swapchains are created with the same format. A
+// swapchain is replaced as a whole when its surface changes size.
 class Swapchain {
 public:
-  operator vk::SwapchainKHR &() { return swapchain; }
-
-  vk::SwapchainKHR *operator->() { return &swapchain; }
+  // Windowed. fallbackExtent is only used if the surface doesn't dictate its own size. oldSwapchain, if given, is
+  // being replaced: images already acquired from it stay valid and the driver can reuse its resources.
+  Swapchain(Device *device_, vk::SurfaceKHR surface, vk::Format format_, vk::Extent2D fallbackExtent,
+            vk::SwapchainKHR oldSwapchain = nullptr)
+      : device(device_), format(format_)
+  {
+    createSwapchain(surface, fallbackExtent, oldSwapchain);
+    createImageViews();
+  }
 
-  Swapchain(Device *device_, ViewportInfo *info) : device(device_), viewportInfo(info)
+  // Headless.
+  Swapchain(Device *device_, MemoryAllocator *allocator_, vk::Format format_, vk::Extent2D extent_, uint32_t imageCount)
+      : device(device_), allocator(allocator_), format(format_), extent(extent_)
   {
-    createSwapchain();
+    createOffscreenImages(imageCount);
     createImageViews();
   }
 
-  Swapchain() {}
   ~Swapchain()
   {
-    std::cout << "Destroying swapchain." << std::endl;
-    cleanupSwapchain();
+    Device &d = *device;
+    for (auto framebuffer : framebuffers) {
+      d->destroyFramebuffer(framebuffer);
+    }
+
+    for (auto imageView : imageViews) {
+      d->destroyImageView(imageView);
+    }
+
+    if (swapchain) {
+      d->destroySwapchainKHR(swapchain);
+    }
+    for (size_t i = 0; i < offscreenImagesMemory.size(); i++) {
+      d->destroyImage(images[i]);
+      allocator->free(offscreenImagesMemory[i]);
+    }
   }
 
-  const ViewportInfo &getViewportInfo() { return *viewportInfo; }
-  const vk::Extent2D &getExtent() { return viewportInfo->surfaceExtent; }
+  Swapchain(const Swapchain &) = delete;
+  Swapchain &operator=(const Swapchain &) = delete;
+
+  operator vk::SwapchainKHR() const { return swapchain; }
 
-  void createFramebuffers(vk::RenderPass &renderPass)
+  bool isOffscreen() const { return !swapchain; }
+  vk::Format getFormat() const { return format; }
+  const vk::Extent2D &getExtent() const { return extent; }
+  uint32_t getImageCount() const { return static_cast<uint32_t>(images.size()); }
+  vk::Framebuffer getFramebuffer(uint32_t imageIndex) const { return framebuffers[imageIndex]; }
+
+  void createFramebuffers(vk::RenderPass renderPass)
   {
-    swapchainFramebuffers.resize(swapchainImageViews.size());
+    framebuffers.resize(imageViews.size());
 
-    for (size_t i = 0; i < swapchainImageViews.size(); i++) {
-      vk::ImageView attachments[] = { swapchainImageViews[i] };
+    for (size_t i = 0; i < imageViews.size(); i++) {
+      vk::ImageView attachments[] = { imageViews[i] };
 
       vk::FramebufferCreateInfo framebufferInfo = {};
       framebufferInfo.renderPass = renderPass;
       framebufferInfo.attachmentCount = 1;
       framebufferInfo.pAttachments = attachments;
-      framebufferInfo.width = viewportInfo->surfaceExtent.width;
-      framebufferInfo.height = viewportInfo->surfaceExtent.height;
+      framebufferInfo.width = extent.width;
+      framebufferInfo.height = extent.height;
       framebufferInfo.layers = 1;
 
       try {
-        swapchainFramebuffers[i] = (*device)->createFramebuffer(framebufferInfo);
+        framebuffers[i] = (*device)->createFramebuffer(framebufferInfo);
       }
       catch (vk::SystemError) {
         throw std::runtime_error("failed to create framebuffer!");
@@ -74,28 +92,92 @@ public:
     }
   }
 
+  static vk::SurfaceFormatKHR chooseSurfaceFormat(const std::vector<vk::SurfaceFormatKHR> &availableFormats)
+  {
+    if (availableFormats.size() == 1 && availableFormats[0].format == vk::Format::eUndefined) {
+      return { vk::Format::eB8G8R8A8Unorm, vk::ColorSpaceKHR::eSrgbNonlinear };
+    }
+
+    for (const auto &availableFormat : availableFormats) {
+      if (availableFormat.format == vk::Format::eB8G8R8A8Unorm &&
+          availableFormat.colorSpace == vk::ColorSpaceKHR::eSrgbNonlinear) {
+        return availableFormat;
+      }
+    }
+
+    return availableFormats[0];
+  }
+
+  static vk::PresentModeKHR choosePresentMode(const std::vector<vk::PresentModeKHR> availablePresentModes)
+  {
+    vk::PresentModeKHR bestMode = vk::PresentModeKHR::eFifo;
 
+    for (const auto &availablePresentMode : availablePresentModes) {
+      if (availablePresentMode == vk::PresentModeKHR::eMailbox) {
+        return availablePresentMode;
+      }
+      else if (availablePresentMode == vk::PresentModeKHR::eImmediate) {
+        bestMode = availablePresentMode;
+      }
+    }
+
+    return bestMode;
+  }
+
+  // The size a swapchain for this surface would get. 0x0 while the window is minimized.
+  static vk::Extent2D chooseExtent(const vk::SurfaceCapabilitiesKHR &capabilities, vk::Extent2D fallbackExtent)
+  {
+    if (capabilities.currentExtent.width != std::numeric_limits<uint32_t>::max()) {
+      return capabilities.currentExtent;
+    }
+    else {
+      vk::Extent2D actualExtent = fallbackExtent;
+
+      actualExtent.width =
+          std::max(capabilities.minImageExtent.width, std::min(capabilities.maxImageExtent.width, actualExtent.width));
+      actualExtent.height = std::max(
+          capabilities.minImageExtent.height,
+          std::min(capabilities.maxImageExtent.height, actualExtent.height)
+      );
+
+      return actualExtent;
+    }
+  }
+
+private:
   Device *device;
-  ViewportInfo *viewportInfo;
+  MemoryAllocator *allocator = nullptr;
 
   vk::SwapchainKHR swapchain;
-  std::vector<vk::Image> swapchainImages;
-  std::vector<vk::ImageView> swapchainImageViews;
-  std::vector<vk::Framebuffer> swapchainFramebuffers;
+  vk::Format format;
+  vk::Extent2D extent;
+  std::vector<vk::Image> images;
+  std::vector<vk::ImageView> imageViews;
+  std::vector<vk::Framebuffer> framebuffers;
 
-  // vk::Extent2D swapchainExtent;
-  // vk::Format swapchainImageFormat;
+  // Headless only. These back images when there is no swapchain.
+  std::vector<Allocation> offscreenImagesMemory;
 
-private:
-  void createSwapchain()
+  void createSwapchain(vk::SurfaceKHR surface, vk::Extent2D fallbackExtent, vk::SwapchainKHR oldSwapchain)
   {
-    const vk::SurfaceKHR &surface = viewportInfo->surface;
+    SwapchainSupportDetails swapchainSupport = device->querySwapchainSupport(surface);
 
-    SurfaceSupportDetails swapchainSupport = querySurfaceSupport(surface);
+    // The format is fixed by the render pass. Any color space the surface offers for it will do.
+    auto surfaceFormat = std::find_if(
+        swapchainSupport.formats.begin(),
+        swapchainSupport.formats.end(),
+        [&](const vk::SurfaceFormatKHR &available) { return available.format == format; }
+    );
+    vk::ColorSpaceKHR colorSpace = vk::ColorSpaceKHR::eSrgbNonlinear;
+    if (surfaceFormat != swapchainSupport.formats.end()) {
+      colorSpace = surfaceFormat->colorSpace;
+    }
+    else if (!(swapchainSupport.formats.size() == 1 && swapchainSupport.formats[0].format == vk::Format::eUndefined)) {
+      throw std::runtime_error("surface does not support the format of the other viewports!");
+    }
 
-    vk::PresentModeKHR presentMode = vk::PresentModeKHR::eMailbox;
-    viewportInfo->surfaceFormat = { vk::Format::eB8G8R8A8Unorm, vk::ColorSpaceKHR::eSrgbNonlinear };
-    viewportInfo->surfaceExtent = swapchainSupport.capabilities.currentExtent;
+    vk::PresentModeKHR presentMode = choosePresentMode(swapchainSupport.presentModes);
+    extent = chooseExtent(swapchainSupport.capabilities, fallbackExtent);
 
     uint32_t imageCount = swapchainSupport.capabilities.minImageCount + 1;
     if (swapchainSupport.capabilities.maxImageCount > 0 && imageCount > swapchainSupport.capabilities.maxImageCount) {
@@ -106,9 +188,9 @@ private:
         vk::SwapchainCreateFlagsKHR(),
         surface,
         imageCount,
-        viewportInfo->surfaceFormat.format,
-        viewportInfo->surfaceFormat.colorSpace,
-        viewportInfo->surfaceExtent,
+        format,
+        colorSpace,
+        extent,
         1, // imageArrayLayers
         vk::ImageUsageFlagBits::eColorAttachment
     );
@@ -130,7 +212,7 @@ private:
     createInfo.presentMode = presentMode;
     createInfo.clipped = VK_TRUE;
 
-    createInfo.oldSwapchain = vk::SwapchainKHR(nullptr);
+    createInfo.oldSwapchain = oldSwapchain;
 
     try {
       swapchain = (*device)->createSwapchainKHR(createInfo);
@@ -139,21 +221,58 @@ private:
       throw std::runtime_error("failed to create swap chain!");
     }
 
-    swapchainImages = (*device)->getSwapchainImagesKHR(swapchain);
+    images = (*device)->getSwapchainImagesKHR(swapchain);
 
-    std::cout << "Created swapchain with extent " << viewportInfo->surfaceExtent.width << " "
-              << viewportInfo->surfaceExtent.height << std::endl;
+    std::cout << "Created swapchain with extent " << extent.width << " " << extent.height << std::endl;
+  }
+
+  // Headless replacement for createSwapchain. One device-local color image per frame in flight, so every image is
+  // protected by the in-flight fence of the frame that renders into it.
+  void createOffscreenImages(uint32_t imageCount)
+  {
+    images.resize(imageCount);
+    offscreenImagesMemory.resize(imageCount);
+
+    for (size_t i = 0; i < imageCount; i++) {
+      vk::ImageCreateInfo imageInfo = {};
+      imageInfo.imageType = vk::ImageType::e2D;
+      imageInfo.format = format;
+      imageInfo.extent = vk::Extent3D { extent.width, extent.height, 1 };
+      imageInfo.mipLevels = 1;
+      imageInfo.arrayLayers = 1;
+      imageInfo.samples = vk::SampleCountFlagBits::e1;
+      imageInfo.tiling = vk::ImageTiling::eOptimal;
+      imageInfo.usage = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransferSrc;
+      imageInfo.sharingMode = vk::SharingMode::eExclusive;
+      imageInfo.initialLayout = vk::ImageLayout::eUndefined;
+
+      try {
+        images[i] = (*device)->createImage(imageInfo);
+      }
+      catch (vk::SystemError) {
+        throw std::runtime_error("failed to create offscreen image!");
+      }
+
+      offscreenImagesMemory[i] = allocator->allocate(
+          (*device)->getImageMemoryRequirements(images[i]),
+          vk::MemoryPropertyFlagBits::eDeviceLocal,
+          ResourceKind::Optimal
+      );
+      allocator->bindImage(images[i], offscreenImagesMemory[i]);
+    }
+
+    std::cout << "Created offscreen targets with extent " << extent.width << " " << extent.height << std::endl;
   }
 
   void createImageViews()
   {
-    swapchainImageViews.resize(swapchainImages.size());
+    imageViews.resize(images.size());
 
-    for (size_t i = 0; i < swapchainImages.size(); i++) {
+    for (size_t i = 0; i < images.size(); i++) {
       vk::ImageViewCreateInfo createInfo = {};
-      createInfo.image = swapchainImages[i];
+      createInfo.image = images[i];
       createInfo.viewType = vk::ImageViewType::e2D;
-      createInfo.format = viewportInfo->surfaceFormat.format;
+      createInfo.format = format;
       createInfo.components.r = vk::ComponentSwizzle::eIdentity;
       createInfo.components.g = vk::ComponentSwizzle::eIdentity;
       createInfo.components.b = vk::ComponentSwizzle::eIdentity;
@@ -165,44 +284,13 @@ private:
       createInfo.subresourceRange.layerCount = 1;
 
       try {
-        swapchainImageViews[i] = (*device)->createImageView(createInfo);
+        imageViews[i] = (*device)->createImageView(createInfo);
       }
       catch (vk::SystemError) {
         throw std::runtime_error("failed to create image views!");
       }
     }
   }
-
-  SurfaceSupportDetails querySurfaceSupport(const vk::SurfaceKHR &surface)
-  {
-    vk::PhysicalDevice &physicalDevice = *device->getPhysicalDevice();
-    SurfaceSupportDetails details;
-    details.capabilities = physicalDevice.getSurfaceCapabilitiesKHR(surface);
-    details.formats = physicalDevice.getSurfaceFormatsKHR(surface);
-    details.presentModes = physicalDevice.getSurfacePresentModesKHR(surface);
-
-    return details;
-  }
-
-  void cleanupSwapchain()
-  {
-    Device &d = *device;
-    for (auto framebuffer : swapchainFramebuffers) {
-      d->destroyFramebuffer(framebuffer);
-    }
-
-    // d->freeCommandBuffers(commandPool, commandBuffers);
-
-    // d->destroyPipeline(graphicsPipeline);
-    // d->destroyPipelineLayout(pipelineLayout);
-    // d->destroyRenderPass(renderPass);
-
-    for (auto imageView : swapchainImageViews) {
-      d->destroyImageView(imageView);
-    }
-
-    d->destroySwapchainKHR(swapchain);
-  }
 };
 
 #endif
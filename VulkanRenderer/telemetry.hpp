@@ -0,0 +1,62 @@
+#pragma once
+#ifndef TELEMETRY_HH
+#define TELEMETRY_HH
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "interop.h"
+
+// Single-producer/single-consumer ring. The render thread pushes, the UI polls with pop at whatever rate it likes.
+// Neither side ever blocks: when the consumer falls behind, new samples are dropped (and counted) rather than making
+// the render thread wait.
+template <typename T, size_t Capacity> class SpscRing {
+  static_assert((Capacity & (Capacity - 1)) == 0, "SpscRing capacity must be a power of two");
+
+public:
+  // Producer side.
+  bool push(const T &value)
+  {
+    size_t head = m_head.load(std::memory_order_relaxed);
+    if (head - m_tail.load(std::memory_order_acquire) == Capacity) {
+      m_dropped.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+
+    m_items[head & (Capacity - 1)] = value;
+    m_head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side. Copies up to max of the oldest items into out and returns how many were copied.
+  size_t pop(T *out, size_t max)
+  {
+    size_t tail = m_tail.load(std::memory_order_relaxed);
+    size_t available = m_head.load(std::memory_order_acquire) - tail;
+    size_t count = available < max ? available : max;
+
+    for (size_t i = 0; i < count; i++) {
+      out[i] = m_items[(tail + i) & (Capacity - 1)];
+    }
+
+    m_tail.store(tail + count, std::memory_order_release);
+    return count;
+  }
+
+  uint64_t dropped() const { return m_dropped.load(std::memory_order_relaxed); }
+
+private:
+  // Head and tail live on separate cache lines so the two threads don't false-share.
+  alignas(64) std::atomic<size_t> m_head { 0 };
+  alignas(64) std::atomic<size_t> m_tail { 0 };
+  alignas(64) std::atomic<uint64_t> m_dropped { 0 };
+  T m_items[Capacity];
+};
+
+// About four seconds of samples at 240 fps.
+const size_t PERF_SAMPLE_CAPACITY = 1024;
+
+using TelemetryRing = SpscRing<sFrameSample, PERF_SAMPLE_CAPACITY>;
+
+#endif
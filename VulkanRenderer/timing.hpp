@@ -9,6 +9,9 @@ class Timing {
 public:
   void tick() { tic_time = timing_clock::now(); }
 
+  // Time since the last tick or tock, without restarting.
+  T peek() const { return std::chrono::duration_cast<T>(timing_clock::now() - tic_time); }
+
   T tock()
   {
     auto dur = std::chrono::duration_cast<T>(timing_clock::now() - tic_time);
@@ -0,0 +1,309 @@
+#pragma once
+#ifndef TRANSFORMS_HH
+#define TRANSFORMS_HH
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "jobs.hpp"
+#include "simd.hpp"
+
+// Local placement of a node relative to its parent: scaled, then rotated, then translated.
+struct Transform {
+  glm::vec3 translation = glm::vec3(0.0f);
+  glm::quat rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+  glm::vec3 scale = glm::vec3(1.0f);
+};
+
+// Column-major 4x4 products, out = a * b. out may not alias a or b.
+namespace mat4simd {
+
+inline void multiplyScalar(const float *a, const float *b, float *out)
+{
+  for (int c = 0; c < 4; c++) {
+    for (int r = 0; r < 4; r++) {
+      out[c * 4 + r] =
+          a[r] * b[c * 4] + a[4 + r] * b[c * 4 + 1] + a[8 + r] * b[c * 4 + 2] + a[12 + r] * b[c * 4 + 3];
+    }
+  }
+}
+
+#ifdef SIMD_X86
+// Every column of the result is the columns of a weighted by one column of b: four broadcasts, four multiplies and
+// three adds per column instead of sixteen dot products.
+inline void multiplySse(const float *a, const float *b, float *out)
+{
+  __m128 a0 = _mm_loadu_ps(a);
+  __m128 a1 = _mm_loadu_ps(a + 4);
+  __m128 a2 = _mm_loadu_ps(a + 8);
+  __m128 a3 = _mm_loadu_ps(a + 12);
+  for (int c = 0; c < 4; c++) {
+    __m128 column = _mm_add_ps(
+        _mm_add_ps(_mm_mul_ps(a0, _mm_set1_ps(b[c * 4])), _mm_mul_ps(a1, _mm_set1_ps(b[c * 4 + 1]))),
+        _mm_add_ps(_mm_mul_ps(a2, _mm_set1_ps(b[c * 4 + 2])), _mm_mul_ps(a3, _mm_set1_ps(b[c * 4 + 3])))
+    );
+    _mm_storeu_ps(out + c * 4, column);
+  }
+}
+#endif
+
+#ifdef SIMD_NEON
+inline void multiplyNeon(const float *a, const float *b, float *out)
+{
+  float32x4_t a0 = vld1q_f32(a);
+  float32x4_t a1 = vld1q_f32(a + 4);
+  float32x4_t a2 = vld1q_f32(a + 8);
+  float32x4_t a3 = vld1q_f32(a + 12);
+  for (int c = 0; c < 4; c++) {
+    float32x4_t bc = vld1q_f32(b + c * 4);
+    float32x4_t column = vmulq_laneq_f32(a0, bc, 0);
+    column = vfmaq_laneq_f32(column, a1, bc, 1);
+    column = vfmaq_laneq_f32(column, a2, bc, 2);
+    column = vfmaq_laneq_f32(column, a3, bc, 3);
+    vst1q_f32(out + c * 4, column);
+  }
+}
+#endif
+
+// The widest product this build has.
+inline void multiply(const float *a, const float *b, float *out)
+{
+#if defined(SIMD_X86)
+  multiplySse(a, b, out);
+#elif defined(SIMD_NEON)
+  multiplyNeon(a, b, out);
+#else
+  multiplyScalar(a, b, out);
+#endif
+}
+
+} // namespace mat4simd
+
+// The matrix of t, written out directly rather than as three glm products.
+inline glm::mat4 composeTransform(const Transform &t)
+{
+  const glm::quat &q = t.rotation;
+  float xx = q.x * q.x, yy = q.y * q.y, zz = q.z * q.z;
+  float xy = q.x * q.y, xz = q.x * q.z, yz = q.y * q.z;
+  float wx = q.w * q.x, wy = q.w * q.y, wz = q.w * q.z;
+
+  glm::mat4 m;
+  m[0] = glm::vec4(1.0f - 2.0f * (yy + zz), 2.0f * (xy + wz), 2.0f * (xz - wy), 0.0f) * t.scale.x;
+  m[1] = glm::vec4(2.0f * (xy - wz), 1.0f - 2.0f * (xx + zz), 2.0f * (yz + wx), 0.0f) * t.scale.y;
+  m[2] = glm::vec4(2.0f * (xz + wy), 2.0f * (yz - wx), 1.0f - 2.0f * (xx + yy), 0.0f) * t.scale.z;
+  m[3] = glm::vec4(t.translation, 1.0f);
+  return m;
+}
+
+// A transform hierarchy in flat arrays. Nodes are stored in depth-first order, so every parent comes before its
+// children and every subtree is one contiguous run that ends at the next node no deeper than its root. Moving a node
+// only recomputes that run, however big the rest of the scene is.
+//
+// Nodes are identified by the NodeId addNode returns, which stays valid when nodes are inserted in front of them.
+// Building the tree depth first (every new node a child of the last one or of one of its ancestors) only appends;
+// anything else has to shift the arrays. Not thread safe.
+class TransformHierarchy {
+public:
+  using NodeId = uint32_t;
+  static const NodeId NO_PARENT = UINT32_MAX;
+
+  NodeId addNode(NodeId parent, const Transform &local = Transform())
+  {
+    uint32_t parentSlot = parent == NO_PARENT ? NO_PARENT : slotOf[parent];
+    uint32_t depth = parent == NO_PARENT ? 0 : depths[parentSlot] + 1;
+
+    // Where the depth-first order wants the node: right after the parent's subtree.
+    uint32_t slot = static_cast<uint32_t>(parents.size());
+    if (!isOnLastPath(parentSlot)) {
+      slot = parentSlot + 1;
+      while (slot < parents.size() && depths[slot] >= depth) {
+        slot++;
+      }
+    }
+
+    NodeId id = static_cast<NodeId>(slotOf.size());
+    slotOf.push_back(slot);
+
+    if (slot == parents.size()) {
+      parents.push_back(parentSlot);
+      depths.push_back(depth);
+      ids.push_back(id);
+      locals.push_back(local);
+      worlds.emplace_back(1.0f);
+
+      lastPath.resize(depth);
+      lastPath.push_back(slot);
+    }
+    else {
+      insertAt(slot, parentSlot, depth, id, local);
+    }
+
+    dirty.push_back(slot);
+    return id;
+  }
+
+  size_t size() const { return parents.size(); }
+
+  const Transform &getLocal(NodeId id) const { return locals[slotOf[id]]; }
+
+  // World matrix as of the last update.
+  const glm::mat4 &getWorld(NodeId id) const { return worlds[slotOf[id]]; }
+
+  NodeId getParent(NodeId id) const
+  {
+    uint32_t parentSlot = parents[slotOf[id]];
+    return parentSlot == NO_PARENT ? NO_PARENT : ids[parentSlot];
+  }
+
+  void setLocal(NodeId id, const Transform &local)
+  {
+    uint32_t slot = slotOf[id];
+    locals[slot] = local;
+    dirty.push_back(slot);
+  }
+
+  // Recomputes everything on the next update, for a new consumer of the world matrices.
+  void markAllDirty()
+  {
+    dirty.clear();
+    for (uint32_t slot = 0; slot < parents.size(); slot++) {
+      if (depths[slot] == 0) {
+        dirty.push_back(slot);
+      }
+    }
+  }
+
+  bool hasChanges() const { return !dirty.empty(); }
+
+  // Recomputes the world matrices of every subtree whose root changed since the last update and hands each new one to
+  // sink(NodeId, const glm::mat4 &), so it can go straight into a mapped uniform or instance buffer, or a draw list.
+  // Returns the number of nodes recomputed. With jobs, separate subtrees are recomputed in parallel and sink has to
+  // cope with being called from several threads at once (for different nodes).
+  template <typename Sink>
+  size_t update(Sink &&sink, JobSystem *jobs = nullptr)
+  {
+    if (dirty.empty()) {
+      return 0;
+    }
+
+    // A changed node inside a subtree that is recomputed anyway costs nothing extra.
+    std::sort(dirty.begin(), dirty.end());
+    runs.clear();
+    size_t updated = 0;
+    for (uint32_t root : dirty) {
+      if (!runs.empty() && root < runs.back().second) {
+        continue;
+      }
+      uint32_t end = root + 1;
+      while (end < parents.size() && depths[end] > depths[root]) {
+        end++;
+      }
+      runs.push_back({ root, end });
+      updated += end - root;
+    }
+    dirty.clear();
+
+    // Runs never overlap and only read world matrices outside of every run, so they can go in any order.
+    if (jobs && runs.size() > 1) {
+      size_t grain = std::max<size_t>(1, runs.size() / (4 * (jobs->getWorkerCount() + 1)));
+      jobs->parallelFor(
+          runs.size(),
+          grain,
+          [&](size_t begin, size_t end) {
+            for (size_t r = begin; r < end; r++) {
+              recomputeRun(runs[r].first, runs[r].second, sink);
+            }
+          },
+          "transforms"
+      );
+    }
+    else {
+      for (const auto &run : runs) {
+        recomputeRun(run.first, run.second, sink);
+      }
+    }
+    return updated;
+  }
+
+  size_t update()
+  {
+    return update([](NodeId, const glm::mat4 &) {});
+  }
+
+private:
+  // Per slot, in depth-first order.
+  std::vector<uint32_t> parents; // Slot of the parent, NO_PARENT for roots
+  std::vector<uint32_t> depths;  // 0 for roots
+  std::vector<NodeId> ids;
+  std::vector<Transform> locals;
+  std::vector<glm::mat4> worlds;
+
+  std::vector<uint32_t> slotOf;   // Per NodeId
+  std::vector<uint32_t> lastPath; // Slots from a root down to the last slot, one per depth
+  std::vector<uint32_t> dirty;    // Slots whose local transform changed
+
+  // Slot ranges of the subtrees to recompute. Scratch for update, kept to save the allocation.
+  std::vector<std::pair<uint32_t, uint32_t>> runs;
+
+  template <typename Sink>
+  void recomputeRun(uint32_t begin, uint32_t end, Sink &sink)
+  {
+    for (uint32_t slot = begin; slot < end; slot++) {
+      glm::mat4 local = composeTransform(locals[slot]);
+      uint32_t parentSlot = parents[slot];
+      if (parentSlot == NO_PARENT) {
+        worlds[slot] = local;
+      }
+      else {
+        mat4simd::multiply(&worlds[parentSlot][0][0], &local[0][0], &worlds[slot][0][0]);
+      }
+      sink(ids[slot], worlds[slot]);
+    }
+  }
+
+  // Whether a child of parentSlot can simply be appended: the last slot is parentSlot or lies in its subtree.
+  bool isOnLastPath(uint32_t parentSlot) const
+  {
+    if (parentSlot == NO_PARENT) {
+      return true;
+    }
+    uint32_t depth = depths[parentSlot];
+    return depth < lastPath.size() && lastPath[depth] == parentSlot;
+  }
+
+  void insertAt(uint32_t slot, uint32_t parentSlot, uint32_t depth, NodeId id, const Transform &local)
+  {
+    parents.insert(parents.begin() + slot, parentSlot);
+    depths.insert(depths.begin() + slot, depth);
+    ids.insert(ids.begin() + slot, id);
+    locals.insert(locals.begin() + slot, local);
+    worlds.insert(worlds.begin() + slot, glm::mat4(1.0f));
+
+    // Everything behind the new node moved up by one.
+    for (uint32_t s = slot + 1; s < parents.size(); s++) {
+      if (parents[s] != NO_PARENT && parents[s] >= slot) {
+        parents[s]++;
+      }
+      slotOf[ids[s]] = s;
+    }
+    for (uint32_t &d : dirty) {
+      if (d >= slot) {
+        d++;
+      }
+    }
+
+    // The last slot didn't change, but its path may have shifted.
+    lastPath.clear();
+    for (uint32_t s = static_cast<uint32_t>(parents.size()) - 1; s != NO_PARENT; s = parents[s]) {
+      lastPath.push_back(s);
+    }
+    std::reverse(lastPath.begin(), lastPath.end());
+  }
+};
+
+#endif
@@ -0,0 +1,123 @@
+#pragma once
+#ifndef UNIFORMS_HH
+#define UNIFORMS_HH
+
+#include <vulkan/vulkan.hpp>
+
+#include <cstring>
+#include <vector>
+
+#include "allocator.hpp"
+#include "device.hpp"
+
+// Per frame in flight capacity of the uniform ring. At 256 byte alignment that is 8192 objects per frame.
+const vk::DeviceSize UNIFORM_RING_SIZE = 2ull * 1024 * 1024;
+
+// Where a push landed. offset is what goes into pDynamicOffsets when binding the frame's descriptor set.
+struct UniformSlice {
+  uint32_t offset = 0;
+  void *data = nullptr;
+};
+
+// One persistently mapped uniform buffer per frame in flight. Per-object uniform data is bump allocated out of the
+// current frame's buffer and bound through a single eUniformBufferDynamic descriptor, so the number of descriptor sets
+// does not grow with the number of draws.
+//
+// begin must be called after the frame's fence has been waited on; that is what makes it safe to overwrite the data
+// written the last time this frame slot was used. Render thread only.
+class UniformRing {
+public:
+  UniformRing(Device *device_, MemoryAllocator *allocator_, uint32_t framesInFlight,
+              vk::DeviceSize capacity_ = UNIFORM_RING_SIZE)
+      : device(device_), allocator(allocator_), capacity(capacity_)
+  {
+    alignment = device->getPhysicalDevice()->getProperties().limits.minUniformBufferOffsetAlignment;
+
+    frames.resize(framesInFlight);
+    for (auto &frame : frames) {
+      vk::BufferCreateInfo bufferInfo = {};
+      bufferInfo.size = capacity;
+      bufferInfo.usage = vk::BufferUsageFlagBits::eUniformBuffer;
+      bufferInfo.sharingMode = vk::SharingMode::eExclusive;
+
+      try {
+        frame.buffer = (*device)->createBuffer(bufferInfo);
+      }
+      catch (vk::SystemError) {
+        throw std::runtime_error("failed to create uniform ring buffer!");
+      }
+
+      frame.memory = allocator->allocate(
+          (*device)->getBufferMemoryRequirements(frame.buffer),
+          vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent
+      );
+      allocator->bindBuffer(frame.buffer, frame.memory);
+    }
+  }
+
+  ~UniformRing()
+  {
+    for (auto &frame : frames) {
+      (*device)->destroyBuffer(frame.buffer);
+      allocator->free(frame.memory);
+    }
+  }
+
+  vk::Buffer getBuffer(size_t frame) const { return frames[frame].buffer; }
+
+  // Bytes used by the current frame so far.
+  vk::DeviceSize getUsed() const { return head; }
+
+  vk::DeviceSize getCapacity() const { return capacity; }
+
+  // Distance between consecutive elements of size bytes in an array allocation.
+  vk::DeviceSize stride(vk::DeviceSize size) const { return (size + alignment - 1) / alignment * alignment; }
+
+  void begin(size_t frame)
+  {
+    current = frame;
+    head = 0;
+  }
+
+  UniformSlice allocate(vk::DeviceSize size)
+  {
+    vk::DeviceSize offset = (head + alignment - 1) / alignment * alignment;
+    if (offset + size > capacity) {
+      throw std::runtime_error("uniform ring overflow!");
+    }
+    head = offset + size;
+
+    UniformSlice slice;
+    slice.offset = static_cast<uint32_t>(offset);
+    slice.data = static_cast<uint8_t *>(frames[current].memory.mapped) + offset;
+    return slice;
+  }
+
+  // count elements of size bytes, stride(size) apart. Lets several threads fill disjoint elements without touching
+  // the ring itself.
+  UniformSlice allocateArray(vk::DeviceSize size, size_t count) { return allocate(stride(size) * count); }
+
+  template <typename T> uint32_t push(const T &value)
+  {
+    UniformSlice slice = allocate(sizeof(T));
+    memcpy(slice.data, &value, sizeof(T));
+    return slice.offset;
+  }
+
+private:
+  struct Frame {
+    vk::Buffer buffer;
+    Allocation memory;
+  };
+
+  Device *device;
+  MemoryAllocator *allocator;
+  vk::DeviceSize capacity;
+  vk::DeviceSize alignment = 256;
+
+  std::vector<Frame> frames;
+  size_t current = 0;
+  vk::DeviceSize head = 0;
+};
+
+#endif
@@ -0,0 +1,315 @@
+#pragma once
+#ifndef UPLOAD_HH
+#define UPLOAD_HH
+
+#include <vulkan/vulkan.hpp>
+
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#include "allocator.hpp"
+#include "device.hpp"
+#include "staging.hpp"
+
+// Size in MB of the persistently mapped staging ring uploads are copied through.
+const uint32_t STAGING_RING_SIZE_MB = 32;
+
+// What the graphics submit of a frame has to do to consume the uploads flushed for it. Empty if nothing was uploaded.
+struct UploadSubmission {
+  vk::Semaphore semaphore;        // Wait on this before the first use of any uploaded data
+  vk::PipelineStageFlags waitStage;
+  vk::CommandBuffer acquireCommands; // Queue family acquire barriers. Submit before the frame's own commands.
+};
+
+// Batches buffer uploads and runs them on the transfer queue, so an upload never stalls the GPU or the caller.
+//
+// Producers call upload from any thread. The data is copied into the staging ring straight away and the copy is
+// queued; producers that generate data in place can reserve a ring region themselves and hand it over. Uploads that
+// don't fit into the ring's free space fall back to a staging buffer of their own. Once per frame the render thread
+// calls flush, which records everything queued into that frame's transfer command buffer and submits it. The frame's
+// graphics submit then waits on the returned semaphore.
+//
+// When Device found a dedicated transfer family the destination buffers are released by the transfer queue and
+// acquired by the graphics queue. Otherwise the transfer queue is the graphics queue and the semaphore alone orders
+// things.
+class UploadService {
+public:
+  UploadService(Device *device_, MemoryAllocator *allocator_, uint32_t framesInFlight,
+                uint32_t stagingRingSizeMB = STAGING_RING_SIZE_MB)
+      : device(device_), allocator(allocator_), ring(device_, allocator_, stagingRingSizeMB * 1024ull * 1024)
+  {
+    QueueFamilyIndices indices = device->findQueueFamilies();
+    graphicsFamily = indices.graphicsFamily.value();
+    transferFamily = indices.transferFamily.value_or(graphicsFamily);
+
+    slots.resize(framesInFlight);
+    try {
+      for (auto &slot : slots) {
+        slot.transferPool = (*device)->createCommandPool({ vk::CommandPoolCreateFlagBits::eTransient, transferFamily });
+        slot.transferCommands = (*device)->allocateCommandBuffers(
+            { slot.transferPool, vk::CommandBufferLevel::ePrimary, 1 }
+        )[0];
+
+        if (ownershipTransfer()) {
+          slot.acquirePool = (*device)->createCommandPool({ vk::CommandPoolCreateFlagBits::eTransient, graphicsFamily });
+          slot.acquireCommands = (*device)->allocateCommandBuffers(
+              { slot.acquirePool, vk::CommandBufferLevel::ePrimary, 1 }
+          )[0];
+        }
+
+        slot.semaphore = (*device)->createSemaphore({});
+        slot.fence = (*device)->createFence({ vk::FenceCreateFlagBits::eSignaled });
+      }
+    }
+    catch (vk::SystemError) {
+      throw std::runtime_error("failed to create upload service!");
+    }
+  }
+
+  ~UploadService()
+  {
+    for (auto &slot : slots) {
+      waitForSlot(slot);
+      (*device)->destroyFence(slot.fence);
+      (*device)->destroySemaphore(slot.semaphore);
+      (*device)->destroyCommandPool(slot.transferPool);
+      if (slot.acquirePool) {
+        (*device)->destroyCommandPool(slot.acquirePool);
+      }
+    }
+
+    for (auto &copy : pending) {
+      releaseStaging(copy);
+    }
+  }
+
+  bool ownershipTransfer() const { return transferFamily != graphicsFamily; }
+
+  // Space in the staging ring to write upload data into directly. Empty if the ring is full. A region that was reserved
+  // must be passed to upload, the ring can't reclaim anything behind it otherwise.
+  StagingRegion reserve(vk::DeviceSize size) { return ring.reserve(size); }
+
+  // Copies a region filled by the caller into dst at dstOffset. dstStage/dstAccess describe the first use of the data
+  // on the graphics queue. dst must have been created with eTransferDst and eExclusive sharing.
+  void upload(vk::Buffer dst, vk::DeviceSize dstOffset, const StagingRegion &region,
+              vk::PipelineStageFlags dstStage, vk::AccessFlags dstAccess)
+  {
+    PendingCopy copy;
+    copy.src = region.buffer;
+    copy.ringRegion = region;
+    copy.dst = dst;
+    copy.dstStage = dstStage;
+    copy.dstAccess = dstAccess;
+    copy.region = vk::BufferCopy { region.offset, dstOffset, region.size };
+
+    std::lock_guard<std::mutex> lock(mutex);
+    pending.push_back(copy);
+  }
+
+  // Same as above, copying size bytes from data into the ring first.
+  void upload(vk::Buffer dst, vk::DeviceSize dstOffset, const void *data, vk::DeviceSize size,
+              vk::PipelineStageFlags dstStage, vk::AccessFlags dstAccess)
+  {
+    StagingRegion region = ring.reserve(size);
+    if (region) {
+      memcpy(region.data, data, static_cast<size_t>(size));
+      upload(dst, dstOffset, region, dstStage, dstAccess);
+      return;
+    }
+
+    PendingCopy copy;
+    copy.dst = dst;
+    copy.dstStage = dstStage;
+    copy.dstAccess = dstAccess;
+    copy.region = vk::BufferCopy { 0, dstOffset, size };
+
+    vk::BufferCreateInfo bufferInfo = {};
+    bufferInfo.size = size;
+    bufferInfo.usage = vk::BufferUsageFlagBits::eTransferSrc;
+    bufferInfo.sharingMode = vk::SharingMode::eExclusive;
+
+    try {
+      copy.staging = (*device)->createBuffer(bufferInfo);
+    }
+    catch (vk::SystemError) {
+      throw std::runtime_error("failed to create staging buffer!");
+    }
+    copy.stagingMemory = allocator->allocate(
+        (*device)->getBufferMemoryRequirements(copy.staging),
+        vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent
+    );
+    allocator->bindBuffer(copy.staging, copy.stagingMemory);
+    copy.src = copy.staging;
+    memcpy(copy.stagingMemory.mapped, data, static_cast<size_t>(size));
+
+    std::lock_guard<std::mutex> lock(mutex);
+    pending.push_back(copy);
+  }
+
+  // Render thread only, after the frame's in-flight fence has been waited on. Submits everything queued since the
+  // last flush and returns what the graphics submit has to wait on.
+  UploadSubmission flush(size_t frame)
+  {
+    Slot &slot = slots[frame];
+
+    // The graphics work of this frame waited on the previous batch of this slot, and the frame's fence has signaled,
+    // so this does not block in practice. It tells us when the old staging memory can be reused.
+    waitForSlot(slot);
+    ring.complete(slot.epoch);
+    for (auto &copy : slot.inFlight) {
+      releaseStaging(copy);
+    }
+    slot.inFlight.clear();
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      slot.inFlight.swap(pending);
+    }
+    if (slot.inFlight.empty()) {
+      return {};
+    }
+
+    slot.epoch = ++epoch;
+    for (const auto &copy : slot.inFlight) {
+      if (copy.ringRegion) {
+        ring.retire(copy.ringRegion, slot.epoch);
+      }
+    }
+
+    UploadSubmission submission;
+    submission.semaphore = slot.semaphore;
+    for (const auto &copy : slot.inFlight) {
+      submission.waitStage |= copy.dstStage;
+    }
+
+    (*device)->resetCommandPool(slot.transferPool);
+    slot.transferCommands.begin({ vk::CommandBufferUsageFlagBits::eOneTimeSubmit });
+    for (const auto &copy : slot.inFlight) {
+      slot.transferCommands.copyBuffer(copy.src, copy.dst, copy.region);
+    }
+
+    if (ownershipTransfer()) {
+      // Release on the transfer queue...
+      std::vector<vk::BufferMemoryBarrier> barriers = ownershipBarriers(slot.inFlight, true);
+      slot.transferCommands.pipelineBarrier(
+          vk::PipelineStageFlagBits::eTransfer,
+          vk::PipelineStageFlagBits::eBottomOfPipe,
+          {},
+          nullptr,
+          barriers,
+          nullptr
+      );
+    }
+    slot.transferCommands.end();
+
+    if (ownershipTransfer()) {
+      // ...and acquire on the graphics queue. Its source stage matches the semaphore wait stage, which chains the
+      // two together.
+      std::vector<vk::BufferMemoryBarrier> barriers = ownershipBarriers(slot.inFlight, false);
+      (*device)->resetCommandPool(slot.acquirePool);
+      slot.acquireCommands.begin({ vk::CommandBufferUsageFlagBits::eOneTimeSubmit });
+      slot.acquireCommands.pipelineBarrier(
+          submission.waitStage,
+          submission.waitStage,
+          {},
+          nullptr,
+          barriers,
+          nullptr
+      );
+      slot.acquireCommands.end();
+      submission.acquireCommands = slot.acquireCommands;
+    }
+
+    vk::SubmitInfo submitInfo = {};
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &slot.transferCommands;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores = &slot.semaphore;
+
+    if ((*device)->resetFences(1, &slot.fence) != vk::Result::eSuccess) {
+      throw std::runtime_error("failed to reset fences!");
+    }
+
+    try {
+      device->transferQueue.submit(submitInfo, slot.fence);
+    }
+    catch (vk::SystemError) {
+      throw std::runtime_error("failed to submit upload command buffer!");
+    }
+
+    return submission;
+  }
+
+private:
+  struct PendingCopy {
+    vk::Buffer src;
+    StagingRegion ringRegion; // Set when src is the staging ring
+    vk::Buffer staging;       // Otherwise a staging buffer of its own
+    Allocation stagingMemory;
+    vk::Buffer dst;
+    vk::BufferCopy region;
+    vk::PipelineStageFlags dstStage;
+    vk::AccessFlags dstAccess;
+  };
+
+  struct Slot {
+    vk::CommandPool transferPool;
+    vk::CommandBuffer transferCommands;
+    vk::CommandPool acquirePool;
+    vk::CommandBuffer acquireCommands;
+    vk::Semaphore semaphore;
+    vk::Fence fence;
+    uint64_t epoch = 0; // Of the last batch submitted from this slot
+    std::vector<PendingCopy> inFlight;
+  };
+
+  Device *device;
+  MemoryAllocator *allocator;
+  uint32_t graphicsFamily = 0;
+  uint32_t transferFamily = 0;
+
+  StagingRing ring;
+  uint64_t epoch = 0;
+
+  std::vector<Slot> slots;
+  std::vector<PendingCopy> pending;
+  std::mutex mutex;
+
+  void waitForSlot(Slot &slot)
+  {
+    if ((*device)->waitForFences(1, &slot.fence, VK_TRUE, std::numeric_limits<uint64_t>::max()) !=
+        vk::Result::eSuccess) {
+      throw std::runtime_error("waitForFences timed out!");
+    }
+  }
+
+  void releaseStaging(PendingCopy &copy)
+  {
+    if (!copy.staging) {
+      return;
+    }
+    (*device)->destroyBuffer(copy.staging);
+    allocator->free(copy.stagingMemory);
+  }
+
+  std::vector<vk::BufferMemoryBarrier> ownershipBarriers(const std::vector<PendingCopy> &copies, bool release)
+  {
+    std::vector<vk::BufferMemoryBarrier> barriers;
+    barriers.reserve(copies.size());
+    for (const auto &copy : copies) {
+      vk::BufferMemoryBarrier barrier = {};
+      barrier.srcAccessMask = release ? vk::AccessFlagBits::eTransferWrite : vk::AccessFlags();
+      barrier.dstAccessMask = release ? vk::AccessFlags() : copy.dstAccess;
+      barrier.srcQueueFamilyIndex = transferFamily;
+      barrier.dstQueueFamilyIndex = graphicsFamily;
+      barrier.buffer = copy.dst;
+      barrier.offset = copy.region.dstOffset;
+      barrier.size = copy.region.size;
+      barriers.push_back(barrier);
+    }
+    return barriers;
+  }
+};
+
+#endif